@@ -0,0 +1,203 @@
+#include "driver/i2c_master.h"
+#include "ds1307.h"
+#include "ds1307_checkpoint.h"
+#if CONFIG_DS1307_CONSOLE
+#include "ds1307_console.h"
+#include "esp_console.h"
+#endif
+#include "ds1307_time_source.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define SCL_IO_PIN CONFIG_I2C_MASTER_SCL
+#define SDA_IO_PIN CONFIG_I2C_MASTER_SDA
+#define MASTER_FREQUENCY CONFIG_I2C_MASTER_FREQUENCY
+#define PORT_NUMBER -1
+#define ITERATIONS CONFIG_BENCHMARK_ITERATIONS
+
+static const char *TAG = "app_main";
+
+/* A chip powered up for the first time holds no valid date */
+static void set_default_time(ds1307_handle_t ds1307_handle)
+{
+    struct tm tm = {
+        .tm_year = 2000 - 1900,
+        .tm_mday = 1,
+        .tm_wday = 6, // 2000-01-01 was a Saturday
+    };
+    ESP_LOGW(TAG, "no valid date in the registers, set to 2000-01-01");
+    ESP_ERROR_CHECK(ds1307_set_datetime(ds1307_handle, &tm));
+}
+
+static void benchmark_time_source(ds1307_handle_t ds1307_handle)
+{
+    ds1307_time_selector_handle_t selector;
+    ESP_ERROR_CHECK(ds1307_time_selector_new(&selector));
+    ds1307_time_source_t source;
+    ESP_ERROR_CHECK(ds1307_time_source_system(
+        CONFIG_BENCHMARK_SYSTEM_ACCURACY_MS, &source));
+    ESP_ERROR_CHECK(ds1307_time_selector_add(selector, &source));
+    ESP_ERROR_CHECK(ds1307_time_source_rtc(
+        ds1307_handle, CONFIG_BENCHMARK_RTC_ACCURACY_MS, &source));
+    ESP_ERROR_CHECK(ds1307_time_selector_add(selector, &source));
+
+    // each source's error, its accuracy plus 1 us rounded up to 1 ms: every
+    // level selects a source, the RTC's unless the system clock is better
+    const uint32_t levels[] = {
+        CONFIG_BENCHMARK_RTC_ACCURACY_MS + 1,
+        CONFIG_BENCHMARK_SYSTEM_ACCURACY_MS + 1,
+    };
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        struct timeval tv;
+        const char *name = "none";
+        ds1307_stats_t before, after;
+        ESP_ERROR_CHECK(ds1307_get_stats(ds1307_handle, &before));
+        int64_t start = esp_timer_get_time();
+        esp_err_t ret = ESP_OK;
+        for (int n = 0; n < ITERATIONS && ret == ESP_OK; n++) {
+            ret = ds1307_time_selector_read(selector, levels[i], &tv, &name);
+        }
+        int64_t elapsed = esp_timer_get_time() - start;
+        ESP_ERROR_CHECK(ds1307_get_stats(ds1307_handle, &after));
+        if (ret != ESP_OK) {
+            ESP_LOGI(TAG, "accuracy %6" PRIu32 " ms: %s", levels[i],
+                     esp_err_to_name(ret));
+            continue;
+        }
+        ESP_LOGI(TAG,
+                 "accuracy %6" PRIu32 " ms: %-8s %8.2f us/read, "
+                 "%.2f transactions/read",
+                 levels[i], name, (float)elapsed / ITERATIONS,
+                 (float)(after.read_count - before.read_count) / ITERATIONS);
+    }
+    ESP_ERROR_CHECK(ds1307_time_selector_del(selector));
+}
+
+static void benchmark_isr_read(ds1307_handle_t ds1307_handle)
+{
+    struct timeval tv;
+    uint32_t min = UINT32_MAX, total = 0;
+    for (int n = 0; n < ITERATIONS; n++) {
+        uint32_t start = esp_cpu_get_cycle_count();
+        esp_err_t ret = ds1307_get_timeval_isr(ds1307_handle, &tv);
+        uint32_t cycles = esp_cpu_get_cycle_count() - start;
+        if (ret == ESP_ERR_INVALID_STATE) {
+            ESP_LOGW(TAG, "ds1307_get_timeval_isr: nothing cached, the clock "
+                          "is halted; skipped");
+            return;
+        }
+        ESP_ERROR_CHECK(ret);
+        total += cycles;
+        if (cycles < min) {
+            min = cycles;
+        }
+    }
+    ESP_LOGI(TAG, "ds1307_get_timeval_isr: %" PRIu32 " cycles min, %" PRIu32
+                  " cycles average",
+             min, total / ITERATIONS);
+}
+
+#if CONFIG_DS1307_CONSOLE
+/* Leave the rtc, ram, regs, rtc_stats and rtc_bench commands running */
+static void start_console(ds1307_handle_t ds1307_handle)
+{
+    esp_console_repl_t *repl;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.prompt = "ds1307>";
+#if CONFIG_ESP_CONSOLE_UART_DEFAULT || CONFIG_ESP_CONSOLE_UART_CUSTOM
+    esp_console_dev_uart_config_t dev_config =
+        ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(
+        esp_console_new_repl_uart(&dev_config, &repl_config, &repl));
+#elif CONFIG_ESP_CONSOLE_USB_CDC
+    esp_console_dev_usb_cdc_config_t dev_config =
+        ESP_CONSOLE_DEV_CDC_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(
+        esp_console_new_repl_usb_cdc(&dev_config, &repl_config, &repl));
+#elif CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG
+    esp_console_dev_usb_serial_jtag_config_t dev_config =
+        ESP_CONSOLE_DEV_USB_SERIAL_JTAG_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_console_new_repl_usb_serial_jtag(
+        &dev_config, &repl_config, &repl));
+#endif
+    ESP_ERROR_CHECK(esp_console_register_help_command());
+    ESP_ERROR_CHECK(ds1307_console_register(ds1307_handle));
+    ESP_ERROR_CHECK(esp_console_start_repl(repl));
+}
+#endif
+
+void app_main(void)
+{
+    ESP_LOGI(TAG, "Start");
+
+    i2c_master_bus_config_t i2c_bus_config = {
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .i2c_port = PORT_NUMBER,
+        .scl_io_num = SCL_IO_PIN,
+        .sda_io_num = SDA_IO_PIN,
+        .flags.enable_internal_pullup = true,
+    };
+    i2c_master_bus_handle_t bus_handle;
+    ESP_ERROR_CHECK(i2c_new_master_bus(&i2c_bus_config, &bus_handle));
+
+    const ds1307_config_t ds1307_config = {
+        .ds1307_device.device_address = DS1307_ADDRESS,
+        .ds1307_device.scl_speed_hz = MASTER_FREQUENCY,
+    };
+    ds1307_handle_t ds1307_handle;
+    ESP_ERROR_CHECK(ds1307_init(bus_handle, &ds1307_config, &ds1307_handle));
+
+#if CONFIG_BENCHMARK_CHECKPOINT
+    const ds1307_checkpoint_config_t checkpoint_config = {
+        .eeprom_device.device_address = DS1307_EEPROM_ADDRESS,
+        .eeprom_device.scl_speed_hz = MASTER_FREQUENCY,
+        .period_s = CONFIG_BENCHMARK_CHECKPOINT_PERIOD_S,
+    };
+    ds1307_checkpoint_handle_t checkpoint;
+    bool restored = false;
+    esp_err_t ret = ds1307_checkpoint_new(bus_handle, ds1307_handle,
+                                          &checkpoint_config, &checkpoint);
+    if (ret == ESP_OK) {
+        ESP_ERROR_CHECK(ds1307_checkpoint_restored(checkpoint, &restored));
+    } else { // most likely no EEPROM on the module
+        ESP_LOGW(TAG, "no checkpoint: %s", esp_err_to_name(ret));
+    }
+#endif
+    bool halt;
+    ESP_ERROR_CHECK(ds1307_get_halt(ds1307_handle, &halt));
+    if (halt) {
+        ESP_LOGW(TAG, "clock halted, no usable timestamp until it is set");
+    } else {
+        // esp_timer counts from boot, so this is time-to-usable-timestamp
+        ESP_LOGI(TAG, "usable timestamp %" PRId64 " us after boot",
+                 esp_timer_get_time());
+    }
+#if CONFIG_BENCHMARK_CHECKPOINT
+    if (restored) {
+        ESP_LOGI(TAG, "time restored from the EEPROM checkpoint");
+    }
+#endif
+
+    struct timeval tv;
+    esp_err_t err = ds1307_get_timeval(ds1307_handle, &tv);
+    if (err == ESP_ERR_INVALID_RESPONSE) { // CH is kept: still halted
+        set_default_time(ds1307_handle);
+        err = ds1307_get_timeval(ds1307_handle, &tv);
+    }
+    ESP_ERROR_CHECK(err);
+    settimeofday(&tv, NULL);
+
+    benchmark_time_source(ds1307_handle);
+    benchmark_isr_read(ds1307_handle);
+
+#if CONFIG_DS1307_CONSOLE
+    start_console(ds1307_handle);
+#else
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+#endif
+}
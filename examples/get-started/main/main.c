@@ -11,6 +11,18 @@
 
 static const char *TAG = "app_main";
 
+/* A chip powered up for the first time holds no valid date */
+static void set_default_time(ds1307_handle_t ds1307_handle)
+{
+    struct tm tm = {
+        .tm_year = 2000 - 1900,
+        .tm_mday = 1,
+        .tm_wday = 6, // 2000-01-01 was a Saturday
+    };
+    ESP_LOGW(TAG, "no valid date in the registers, starting at 2000-01-01");
+    ESP_ERROR_CHECK(ds1307_start_datetime(ds1307_handle, &tm));
+}
+
 void app_main(void)
 {
     ESP_LOGI(TAG, "Start");
@@ -51,7 +63,12 @@ void app_main(void)
         ESP_LOG_BUFFER_HEX(TAG, &data, sizeof(data));
 
         struct tm tm;
-        ESP_ERROR_CHECK(ds1307_get_datetime(ds1307_handle, &tm));
+        esp_err_t ret = ds1307_get_datetime(ds1307_handle, &tm);
+        if (ret == ESP_ERR_INVALID_RESPONSE) {
+            set_default_time(ds1307_handle);
+            continue;
+        }
+        ESP_ERROR_CHECK(ret);
         ESP_LOGI(TAG, "Get datetime: %s", asctime(&tm));
         vTaskDelay(pdMS_TO_TICKS(1000));
     }
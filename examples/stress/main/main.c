@@ -0,0 +1,199 @@
+#include "driver/i2c_master.h"
+#include "ds1307.h"
+#include "ds1307_ram_region.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if CONFIG_IDF_TARGET_LINUX
+#include "ds1307_sim.h"
+#endif
+
+#define SCL_IO_PIN CONFIG_I2C_MASTER_SCL
+#define SDA_IO_PIN CONFIG_I2C_MASTER_SDA
+#define MASTER_FREQUENCY CONFIG_I2C_MASTER_FREQUENCY
+#define PORT_NUMBER -1
+#define READER_TASKS CONFIG_STRESS_READER_TASKS
+#define WRITER_TASKS CONFIG_STRESS_WRITER_TASKS
+#define REPORT_INTERVAL CONFIG_STRESS_REPORT_INTERVAL
+#define SLOT_SIZE (DS1307_RAM_SIZE / 8)
+
+static const char *TAG = "app_main";
+
+static ds1307_handle_t ds1307_handle;
+#if CONFIG_STRESS_RAM_REGIONS
+static ds1307_ram_pool_handle_t pool;
+static uint32_t flush_errors;
+#endif
+static uint32_t reads, read_errors;
+static uint32_t writes, write_errors, verify_errors;
+
+/* Counters are bumped by several tasks at once, on either core */
+static void count(uint32_t *counter)
+{
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static uint32_t counted(uint32_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void reader_task(void *arg)
+{
+    while (1) {
+        struct tm tm;
+        if (ds1307_get_datetime(ds1307_handle, &tm) == ESP_OK) {
+            count(&reads);
+        } else {
+            count(&read_errors);
+        }
+    }
+}
+
+#if CONFIG_STRESS_RAM_REGIONS
+static void writer_task(void *arg)
+{
+    char name[DS1307_RAM_REGION_NAME_MAX];
+    snprintf(name, sizeof(name), "writer%u", (unsigned)(uintptr_t)arg);
+    ds1307_ram_region_handle_t region;
+    ESP_ERROR_CHECK(ds1307_ram_region_find(pool, name, &region));
+    uint8_t pattern = 0;
+    while (1) {
+        uint8_t out[SLOT_SIZE], in[SLOT_SIZE];
+        memset(out, pattern++, sizeof(out));
+        if (ds1307_ram_region_write(region, 0, out, sizeof(out)) != ESP_OK ||
+            ds1307_ram_region_read(region, 0, in, sizeof(in)) != ESP_OK) {
+            count(&write_errors);
+            continue;
+        }
+        if (memcmp(out, in, sizeof(out)) != 0) {
+            count(&verify_errors);
+        }
+        count(&writes);
+        vTaskDelay(1); // staging never blocks: let IDLE and the flusher in
+    }
+}
+
+static void flusher_task(void *arg)
+{
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_STRESS_FLUSH_INTERVAL_MS));
+        if (ds1307_ram_pool_flush(pool) != ESP_OK) {
+            count(&flush_errors);
+        }
+    }
+}
+#else
+static void writer_task(void *arg)
+{
+    uint8_t offset = (uint8_t)(uintptr_t)arg * SLOT_SIZE;
+    uint8_t pattern = 0;
+    while (1) {
+        uint8_t out[SLOT_SIZE], in[SLOT_SIZE];
+        memset(out, pattern++, sizeof(out));
+        if (ds1307_set_ram(ds1307_handle, offset, out, sizeof(out)) != ESP_OK ||
+            ds1307_get_ram(ds1307_handle, offset, in, sizeof(in)) != ESP_OK) {
+            count(&write_errors);
+            continue;
+        }
+        if (memcmp(out, in, sizeof(out)) != 0) {
+            count(&verify_errors);
+        }
+        count(&writes);
+    }
+}
+#endif
+
+void app_main(void)
+{
+    ESP_LOGI(TAG, "Start");
+#if CONFIG_IDF_TARGET_LINUX
+    ds1307_sim_attach(); // the bus and the chip are simulated
+    ds1307_sim_set_bus_speed(MASTER_FREQUENCY);
+#endif
+
+    i2c_master_bus_config_t i2c_bus_config = {
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .i2c_port = PORT_NUMBER,
+        .scl_io_num = SCL_IO_PIN,
+        .sda_io_num = SDA_IO_PIN,
+        .flags.enable_internal_pullup = true,
+    };
+    i2c_master_bus_handle_t bus_handle;
+    ESP_ERROR_CHECK(i2c_new_master_bus(&i2c_bus_config, &bus_handle));
+
+    const ds1307_config_t ds1307_config = {
+        .ds1307_device.device_address = DS1307_ADDRESS,
+        .ds1307_device.scl_speed_hz = MASTER_FREQUENCY,
+    };
+    ESP_ERROR_CHECK(ds1307_init(bus_handle, &ds1307_config, &ds1307_handle));
+
+    for (int i = 0; i < READER_TASKS; i++) {
+        xTaskCreate(reader_task, "reader", 2048, NULL, 5, NULL);
+    }
+#if CONFIG_STRESS_RAM_REGIONS
+    ESP_ERROR_CHECK(ds1307_ram_pool_new(ds1307_handle, 0, 0, &pool));
+    for (int i = 0; i < WRITER_TASKS; i++) {
+        char name[DS1307_RAM_REGION_NAME_MAX];
+        snprintf(name, sizeof(name), "writer%d", i);
+        ds1307_ram_region_handle_t region;
+        ESP_ERROR_CHECK(
+            ds1307_ram_region_alloc(pool, name, SLOT_SIZE, &region));
+    }
+    xTaskCreate(flusher_task, "flusher", 2048, NULL, 5, NULL);
+#endif
+    for (int i = 0; i < WRITER_TASKS; i++) {
+        xTaskCreate(writer_task, "writer", 2048, (void *)(uintptr_t)i, 5,
+                    NULL);
+    }
+
+    int64_t start = esp_timer_get_time(), last = start;
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(REPORT_INTERVAL * 1000));
+        int64_t now = esp_timer_get_time();
+        float seconds = (now - last) / 1000000.0f;
+        last = now;
+
+        ds1307_stats_t stats;
+        ESP_ERROR_CHECK(ds1307_get_stats(ds1307_handle, &stats));
+        ESP_ERROR_CHECK(ds1307_reset_stats(ds1307_handle));
+        uint32_t r = __atomic_exchange_n(&reads, 0, __ATOMIC_RELAXED);
+        uint32_t w = __atomic_exchange_n(&writes, 0, __ATOMIC_RELAXED);
+#if CONFIG_STRESS_RAM_REGIONS
+        ESP_LOGI(TAG, "get_datetime %.1f/s, region write+read %.1f/s",
+                 r / seconds, w / seconds);
+        ESP_LOGI(TAG, "flush errors %" PRIu32, counted(&flush_errors));
+#else
+        ESP_LOGI(TAG, "get_datetime %.1f/s, set+get_ram %.1f/s", r / seconds,
+                 w / seconds);
+#endif
+        ESP_LOGI(TAG, "errors: read %" PRIu32 ", write %" PRIu32
+                      ", verify %" PRIu32,
+                 counted(&read_errors), counted(&write_errors),
+                 counted(&verify_errors));
+        ESP_LOGI(TAG,
+                 "bus: %" PRIu32 " transactions, %" PRIu32
+                 " bytes; lock: %" PRIu32 " waits, %.1f us average",
+                 stats.read_count + stats.write_count,
+                 stats.read_bytes + stats.write_bytes, stats.lock_wait_count,
+                 stats.lock_wait_count
+                     ? (float)stats.lock_wait_us / stats.lock_wait_count
+                     : 0.0f);
+#if CONFIG_IDF_TARGET_LINUX
+        if (CONFIG_STRESS_DURATION &&
+            now - start >= CONFIG_STRESS_DURATION * 1000000LL) {
+            uint32_t errors = counted(&read_errors) + counted(&write_errors) +
+                              counted(&verify_errors);
+#if CONFIG_STRESS_RAM_REGIONS
+            errors += counted(&flush_errors);
+#endif
+            ESP_LOGI(TAG, "Done, %" PRIu32 " errors", errors);
+            exit(errors ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+#endif
+    }
+}
@@ -2,10 +2,13 @@
 
 #include "driver/i2c_master.h"
 #include "esp_err.h"
+#include <sys/time.h>
 #include <time.h>
 
 #define DS1307_ADDRESS (0x68)
 #define DS1307_RAM_SIZE (56)
+#define DS1307_REG_IMAGE_SIZE (64) // time, control and RAM registers
+#define DS1307_RAM_GEN_OFFSET (0) // generation byte in multi_master mode
 
 typedef struct {
     uint8_t second; // BCD encoded seconds, same below
@@ -48,15 +51,65 @@ extern "C" {
 typedef struct {
     i2c_device_config_t ds1307_device; /*!< Configuration for ds1307 device */
     int century;                       /*!< Century 21 is 20xx */
+    bool multi_master;                 /*!< Other masters write the chip too */
 } ds1307_config_t;
 
+typedef struct {
+    uint32_t read_count;          /*!< Register read transactions */
+    uint32_t write_count;         /*!< Register write transactions */
+    uint32_t read_bytes;          /*!< Bytes received from the device */
+    uint32_t write_bytes;         /*!< Bytes sent, including reg pointers */
+    uint32_t error_count;         /*!< Transactions that returned an error */
+    uint32_t lock_wait_count;     /*!< Calls that blocked on another task */
+    uint64_t lock_wait_us;        /*!< Total time spent blocked, in us */
+    uint32_t budget_denied_count; /*!< Transactions refused by the budget */
+} ds1307_stats_t;
+
+typedef struct {
+    bool halt;                        /*!< Clock halt (CH) bit of 0x00 */
+    bool hour_12;                     /*!< 12-hour mode bit of 0x02 */
+    bool output;                      /*!< OUT level of the control register */
+    bool square_wave_enable;          /*!< SQWE bit of the control register */
+    ds1307_rate_select_t rate_select; /*!< RS1-RS0 of the control register */
+} ds1307_status_t;
+
+typedef struct {
+    uint32_t cache_ms; /*!< Serve ds1307_get_datetime from the last read,
+                            extrapolated with esp_timer, for this long.
+                            0 always reads the chip */
+    uint32_t max_transactions_per_hour; /*!< Bus budget, 0 for unlimited */
+    bool ram_write_back; /*!< Stage ds1307_set_ram writes until
+                              ds1307_flush_ram */
+    bool sqw_wakeup;     /*!< Drive SQW/OUT at 1Hz for GPIO wakeups */
+    uint32_t transaction_charge_nc; /*!< Charge per transaction in nC,
+                                         0 estimates it from bus speed */
+    uint32_t byte_charge_nc;        /*!< Charge per byte in nC,
+                                         0 estimates it from bus speed */
+} ds1307_low_power_config_t;
+
 typedef struct ds1307_t *ds1307_handle_t;
 
 /**
  * @brief Initialize a DS1307 device handle
  *
  * This function allocates and returns a device handle that encapsulates I2C
- * device information for subsequent operations.
+ * device information for subsequent operations. The handle may be shared
+ * between tasks: each API call holds a per-device lock for the duration of
+ * its bus sequence, so read-modify-write operations never interleave.
+ *
+ * With multi_master set, every write from this driver also increments the
+ * RAM byte at DS1307_RAM_GEN_OFFSET in the same burst, and every time read
+ * picks it up; a changed value tells the driver another master has
+ * written the chip and its cached time, tick phase and RAM shadow are
+ * dropped. The other masters must follow the same protocol, and the byte
+ * is reserved: ds1307_get_ram and ds1307_set_ram reject ranges covering it.
+ * Writes from two masters racing each other are not detected.
+ *
+ * The protocol costs bus traffic. A time read takes 9 bytes instead of 7,
+ * running on through the control register to the generation byte; a time
+ * served from the low-power cache still reads that one byte; and each RAM
+ * write, including every ds1307_flush_ram burst, is preceded by a
+ * one-byte generation read (see ds1307_set_ram).
  *
  * @param[in] bus_handle I2C master bus handle (i2c_master_bus_handle_t)
  * @param[in] ds1307_config Pointer to ds1307_config_t to configure device
@@ -83,7 +136,7 @@ esp_err_t ds1307_init(i2c_master_bus_handle_t bus_handle,
  * @param[in] ds1307_handle Device handle to free
  * @return
  *      - ESP_OK: Deinitialization succeeded
- *      - ESP_ERR_INVALID_ARG / ESP_ERR_NO_MEM: Invalid handle
+ *      - ESP_ERR_INVALID_ARG: Invalid handle
  *      - Other error codes returned by i2c_master_bus_rm_device
  */
 esp_err_t ds1307_deinit(ds1307_handle_t ds1307_handle);
@@ -94,16 +147,45 @@ esp_err_t ds1307_deinit(ds1307_handle_t ds1307_handle);
  * Reads seconds, minutes, hours, weekday, day, month and year registers and
  * converts them to a standard struct tm. Handles 12/24 hour conversion and
  * computes the full year based on the century configured at initialization.
+ * Register contents that are not valid BCD or are out of range for their
+ * field, including a date past the end of its month, are rejected instead
+ * of being decoded. The chip takes every year 00 for a leap year; in
+ * centuries where that is wrong (1900, 2100, ...) a February 29th read from
+ * the chip is reported as March 1st. The registers are left as they are:
+ * see ds1307_fix_leap_day for correcting them.
  *
  * @param[in] ds1307_handle Device handle
  * @param[out] tm Pointer to struct tm to be filled (must not be NULL)
  * @return
  *      - ESP_OK: Read succeeded and tm is populated
- *      - ESP_ERR_INVALID_ARG / ESP_ERR_NO_MEM: Invalid input
+ *      - ESP_ERR_INVALID_ARG: Invalid input
+ *      - ESP_ERR_INVALID_RESPONSE: Registers hold an invalid date or time
  *      - Other I2C-related error codes
  */
 esp_err_t ds1307_get_datetime(ds1307_handle_t ds1307_handle, struct tm *tm);
 
+/**
+ * @brief Correct the February 29th the DS1307 makes up in 1900, 2100, ...
+ *
+ * The chip takes every year 00 for a leap year. If its registers show
+ * February 29th of a year that is not leap, the date is rewritten to March
+ * 1st; otherwise nothing is written. The correction only works during that
+ * phantom day: once the chip has rolled on to March 1st by itself it stays
+ * a day behind for good, so applications running across such a February
+ * should call this at least once a day, or set the time again afterwards.
+ * At 23:59:59 of the phantom day it waits, without holding the device lock,
+ * for the chip to roll over, which takes up to a second.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[out] fixed True if the date registers were rewritten
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: Invalid input
+ *      - ESP_ERR_INVALID_RESPONSE: Registers hold an invalid date or time
+ *      - Other I2C-related error codes
+ */
+esp_err_t ds1307_fix_leap_day(ds1307_handle_t ds1307_handle, bool *fixed);
+
 /**
  * @brief Set the DS1307 date and time from a struct tm
  *
@@ -119,12 +201,125 @@ esp_err_t ds1307_get_datetime(ds1307_handle_t ds1307_handle, struct tm *tm);
  * NULL)
  * @return
  *      - ESP_OK: Write succeeded
- *      - ESP_ERR_INVALID_ARG / ESP_ERR_NO_MEM: Invalid input
+ *      - ESP_ERR_INVALID_ARG: Invalid input, including
+ * fields outside their struct tm range (tm_sec 60 is not supported) and
+ * days past the end of the month
  *      - Other I2C-related error codes
  */
 esp_err_t ds1307_set_datetime(ds1307_handle_t ds1307_handle,
                               const struct tm *tm);
 
+/**
+ * @brief Set the date and time and start the clock in one write
+ *
+ * Same as ds1307_set_datetime, but clears the CH (Clock Halt) bit in the
+ * same burst, so a halted clock starts counting from exactly this time.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[in] tm Pointer to struct tm containing the time to set (must not be
+ * NULL)
+ * @return
+ *      - ESP_OK: Write succeeded
+ *      - ESP_ERR_INVALID_ARG: Invalid input
+ *      - Other I2C-related error codes
+ */
+esp_err_t ds1307_start_datetime(ds1307_handle_t ds1307_handle,
+                                const struct tm *tm);
+
+/**
+ * @brief Read the current time as seconds since the epoch
+ *
+ * The registers are taken to hold UTC. tv_usec continues from the moment
+ * the registers were latched; it is exact once the phase of the seconds
+ * register is known (after ds1307_set_datetime or ds1307_sqw_edge) and may
+ * otherwise lag by up to one second. Honours the low-power cache.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[out] tv Pointer to struct timeval to be filled (must not be NULL)
+ * @return
+ *      - ESP_OK: Read succeeded and tv is populated
+ *      - ESP_ERR_INVALID_ARG: Invalid input
+ *      - ESP_ERR_INVALID_RESPONSE: Registers hold an invalid date or time
+ *      - Other I2C-related error codes
+ */
+esp_err_t ds1307_get_timeval(ds1307_handle_t ds1307_handle, struct timeval *tv);
+
+/**
+ * @brief Get the time of a running clock as a struct timeval
+ *
+ * Like ds1307_get_timeval, but the clock halt (CH) flag is taken from the
+ * same register read as the time: a clock halted between two separate
+ * reads is never mistaken for a running one.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[out] tv Pointer to struct timeval to be filled (must not be NULL)
+ * @return
+ *      - ESP_OK: Read succeeded and tv is populated
+ *      - ESP_ERR_INVALID_ARG: Invalid input
+ *      - ESP_ERR_INVALID_STATE: The clock is halted, or over the low-power
+ * bus budget with nothing cached
+ *      - ESP_ERR_INVALID_RESPONSE: Registers hold an invalid date or time
+ *      - Other I2C-related error codes
+ */
+esp_err_t ds1307_get_timeval_running(ds1307_handle_t ds1307_handle,
+                                     struct timeval *tv);
+
+/**
+ * @brief Read the cached time from an ISR
+ *
+ * Returns the time of the last chip read (or ds1307_set_datetime /
+ * ds1307_sqw_edge) advanced by esp_timer, without touching the bus,
+ * taking a lock or logging. The function and the handle live in internal
+ * RAM, so it may also be called while the flash cache is disabled.
+ * Readers never block writers; a read that overlaps an update retries.
+ * With multi_master, changes made by other masters are only seen once this
+ * driver next reads the chip.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[out] tv Pointer to struct timeval to be filled (must not be NULL)
+ * @return
+ *      - ESP_OK: tv is populated
+ *      - ESP_ERR_INVALID_ARG: Invalid args
+ *      - ESP_ERR_INVALID_STATE: Nothing cached, clock halted, or the cache
+ * is more than about 71 minutes old
+ */
+esp_err_t ds1307_get_timeval_isr(ds1307_handle_t ds1307_handle,
+                                 struct timeval *tv);
+
+/**
+ * @brief Set the DS1307 from seconds since the epoch
+ *
+ * The registers are written as UTC, including the day of week; tv_usec is
+ * ignored. See ds1307_set_datetime.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[in] tv Time to set (must not be NULL)
+ * @return ESP_OK on success or an error code from ds1307_set_datetime
+ */
+esp_err_t ds1307_set_timeval(ds1307_handle_t ds1307_handle,
+                             const struct timeval *tv);
+
+/**
+ * @brief Set the DS1307 from the system clock, phase aligned
+ *
+ * Waits for the next whole second of tv and writes it then, timed so the
+ * chip restarts its seconds countdown at that boundary; the registers then
+ * tick in step with the clock tv was read from. Pass a time read just
+ * before the call, e.g. from gettimeofday. If waiting for the device lock
+ * or reading the hour mode takes it past that boundary, the next whole
+ * second still ahead is written instead, one second later in both clocks.
+ * Blocks for up to about one second with the device lock held.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[in] tv Current time (must not be NULL)
+ * @return
+ *      - ESP_OK: Write succeeded
+ *      - ESP_ERR_INVALID_ARG: Invalid input
+ *      - Other error codes from ds1307_set_datetime
+ */
+esp_err_t ds1307_set_timeval_aligned(ds1307_handle_t ds1307_handle,
+                                     const struct timeval *tv);
+
 /**
  * @brief Read raw register-encoded time data into ds1307_data_t
  *
@@ -139,6 +334,37 @@ esp_err_t ds1307_set_datetime(ds1307_handle_t ds1307_handle,
  */
 esp_err_t ds1307_get_data(ds1307_handle_t ds1307_handle, ds1307_data_t *data);
 
+/**
+ * @brief Read all 64 registers in a single transaction
+ *
+ * Returns the raw image of registers 0x00-0x3F, as the chip holds them
+ * (RAM bytes staged in write-back mode are not merged in):
+ *  - 0x00-0x06: BCD seconds (bit 7 CH), minutes, hours (bit 6 12-hour,
+ *    bit 5 PM in 12-hour mode), day, date, month, year;
+ *  - 0x07: control, bit 7 OUT, bit 4 SQWE, bits 1-0 RS;
+ *  - 0x08-0x3F: the DS1307_RAM_SIZE bytes of RAM, RAM offset 0 first.
+ * ds1307_decode_status picks the flags out of it. Useful for diagnostics
+ * and for diffing snapshots; also refreshes the RAM shadow.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[out] regs Buffer of DS1307_REG_IMAGE_SIZE bytes (must not be NULL)
+ * @return ESP_OK on success or an I2C error code
+ */
+esp_err_t ds1307_get_registers(ds1307_handle_t ds1307_handle, uint8_t *regs);
+
+/**
+ * @brief Decode the halt, hour mode and control flags of a register image
+ *
+ * No bus access: one ds1307_get_registers read answers what would
+ * otherwise take a getter call, and a transaction, per flag.
+ *
+ * @param[in] regs Image from ds1307_get_registers, at least the first
+ * eight registers
+ * @param[out] status Decoded flags
+ * @return ESP_OK on success or ESP_ERR_INVALID_ARG for NULL arguments
+ */
+esp_err_t ds1307_decode_status(const uint8_t *regs, ds1307_status_t *status);
+
 /**
  * @brief Write ds1307_data_t back to the chip in raw register format
  *
@@ -166,11 +392,17 @@ esp_err_t ds1307_get_12_hour(ds1307_handle_t ds1307_handle, bool *mode);
  * @brief Set 12/24 hour mode
  *
  * When switching modes the function reads the current hour register and
- * converts it to preserve the hour semantics (e.g. 00:xx <-> 12:xx).
+ * converts it to preserve the hour semantics (e.g. 00:xx <-> 12:xx). If
+ * the clock shows xx:59:59 the write is deferred until just after the
+ * next tick, so the hour carry cannot be written back over. If the tick
+ * phase turns out stale (the re-read still shows xx:59:59) the seconds
+ * register is polled for the tick instead.
  *
  * @param[in] ds1307_handle Device handle
  * @param[in] mode true to set 12-hour mode, false to set 24-hour mode
- * @return ESP_OK on success or an I2C error code
+ * @return ESP_OK on success, ESP_ERR_INVALID_RESPONSE if the hour register
+ * is invalid, ESP_ERR_TIMEOUT if no tick was seen while polling, or an I2C
+ * error code
  */
 esp_err_t ds1307_set_12_hour(ds1307_handle_t ds1307_handle, const bool mode);
 
@@ -188,10 +420,18 @@ esp_err_t ds1307_get_halt(ds1307_handle_t ds1307_handle, bool *halt);
 /**
  * @brief Set or clear the CH (Clock Halt) bit to stop/start the clock
  *
+ * The seconds register is rewritten together with CH. While the clock runs
+ * the write is kept at least 30 ms away from a seconds tick, using the
+ * known tick phase (ds1307_sqw_edge, ds1307_set_datetime or an earlier
+ * poll) or, when it is unknown or turns out stale, by polling the seconds
+ * register for up to about one second. Like every write of the seconds
+ * register, this forgets the tick phase.
+ *
  * @param[in] ds1307_handle Device handle
  * @param[in] halt true to halt the clock (set CH), false to run the clock
  * (clear CH)
- * @return ESP_OK on success or an I2C error code
+ * @return ESP_OK on success, ESP_ERR_TIMEOUT if no tick was seen while
+ * polling, or an I2C error code
  */
 esp_err_t ds1307_set_halt(ds1307_handle_t ds1307_handle, const bool halt);
 
@@ -259,6 +499,9 @@ esp_err_t ds1307_set_rate_select(ds1307_handle_t ds1307_handle,
  * @brief Read data from DS1307 internal RAM
  *
  * The RAM region starts at register address 0x08 and has DS1307_RAM_SIZE bytes.
+ * In low-power mode bytes already known are served from a shadow copy;
+ * with multi_master that copy is only trusted after the generation byte
+ * has been read back unchanged.
  *
  * @param[in] ds1307_handle Device handle
  * @param[in] offset Offset from the start of RAM (0-based)
@@ -266,7 +509,8 @@ esp_err_t ds1307_set_rate_select(ds1307_handle_t ds1307_handle,
  * @param[in] size Number of bytes to read
  * @return
  *      - ESP_OK: Read succeeded
- *      - ESP_ERR_INVALID_ARG: offset + size exceeds RAM size or invalid args
+ *      - ESP_ERR_INVALID_ARG: size is 0, offset + size exceeds RAM size,
+ * the range covers DS1307_RAM_GEN_OFFSET in multi_master mode or invalid args
  *      - Other I2C-related error codes
  */
 esp_err_t ds1307_get_ram(ds1307_handle_t ds1307_handle, uint8_t offset,
@@ -275,14 +519,120 @@ esp_err_t ds1307_get_ram(ds1307_handle_t ds1307_handle, uint8_t offset,
 /**
  * @brief Write data to DS1307 internal RAM
  *
+ * One write transaction, or none in write-back mode. With multi_master the
+ * write is preceded by a one-byte read of the generation byte, and the new
+ * generation goes either in the same burst, widened down to RAM offset 0
+ * over a short gap of known bytes, or in a second, 2-byte write.
+ *
  * @param[in] ds1307_handle Device handle
  * @param[in] offset Offset from the start of RAM (0-based)
  * @param[in] data Data buffer to write (must not be NULL)
  * @param[in] size Number of bytes to write
  * @return
  *      - ESP_OK: Write succeeded
- *      - ESP_ERR_INVALID_ARG: offset + size exceeds RAM size or invalid args
+ *      - ESP_ERR_INVALID_ARG: size is 0, offset + size exceeds RAM size,
+ * the range covers DS1307_RAM_GEN_OFFSET in multi_master mode or invalid args
  *      - Other I2C-related error codes
  */
 esp_err_t ds1307_set_ram(ds1307_handle_t ds1307_handle, uint8_t offset,
                          const uint8_t *data, uint8_t size);
+
+/**
+ * @brief Get the RAM range open to the application
+ *
+ * All DS1307_RAM_SIZE bytes, or those after DS1307_RAM_GEN_OFFSET in
+ * multi_master mode. No bus access.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[out] offset First usable RAM offset (must not be NULL)
+ * @param[out] size Number of usable bytes from offset (must not be NULL)
+ * @return ESP_OK on success or ESP_ERR_INVALID_ARG for invalid args
+ */
+esp_err_t ds1307_get_ram_range(ds1307_handle_t ds1307_handle, uint8_t *offset,
+                               uint8_t *size);
+
+/**
+ * @brief Enter, reconfigure or leave low-power mode
+ *
+ * Low-power mode trades freshness for fewer bus transactions:
+ *  - ds1307_get_datetime returns the last time read from the chip,
+ *    advanced by esp_timer, while it is younger than cache_ms;
+ *  - with ram_write_back, ds1307_set_ram only updates a shadow copy and
+ *    ds1307_flush_ram writes all staged bytes in merged bursts;
+ *  - with sqw_wakeup, SQW/OUT is set to 1Hz so the application can wake
+ *    on its edges and call ds1307_sqw_edge instead of reading the chip;
+ *  - once max_transactions_per_hour is used up, further transactions fail
+ *    with ESP_ERR_INVALID_STATE and ds1307_get_datetime falls back to the
+ *    cached time regardless of its age.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[in] config Policy to apply, or NULL to flush staged RAM and leave
+ * low-power mode (SQW/OUT is left as configured)
+ * @return ESP_OK on success or an I2C error code
+ */
+esp_err_t ds1307_set_low_power(ds1307_handle_t ds1307_handle,
+                               const ds1307_low_power_config_t *config);
+
+/**
+ * @brief Write RAM bytes staged by ds1307_set_ram in write-back mode
+ *
+ * Adjacent staged ranges are merged into one burst, bridging short gaps
+ * whose contents are already known.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @return ESP_OK on success or an I2C error code
+ */
+esp_err_t ds1307_flush_ram(ds1307_handle_t ds1307_handle);
+
+/**
+ * @brief Report a 1Hz SQW/OUT edge
+ *
+ * Call on the SQW/OUT edge at which the seconds register increments; safe
+ * from a GPIO ISR. The cached time is moved onto the second boundary, so
+ * cached reads stay exact without touching the bus.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if no time is cached yet
+ * or it is too old to extend (about 71 minutes), or ESP_ERR_INVALID_ARG for
+ * invalid handle; nothing is logged
+ */
+esp_err_t ds1307_sqw_edge(ds1307_handle_t ds1307_handle);
+
+/**
+ * @brief Get the estimated charge drawn by driver bus activity
+ *
+ * Each transaction adds a fixed overhead plus a per-byte cost, both
+ * estimated from the bus speed unless set in ds1307_low_power_config_t.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[out] charge_nc Output: charge in nanocoulombs since init
+ * @return ESP_OK on success or ESP_ERR_INVALID_ARG for invalid args
+ */
+esp_err_t ds1307_get_charge(ds1307_handle_t ds1307_handle,
+                            uint64_t *charge_nc);
+
+/**
+ * @brief Get bus transaction statistics
+ *
+ * Every I2C transaction issued by the driver is counted, so the cost of an
+ * API call can be measured as the difference between two snapshots.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[out] stats Output: counters accumulated since init or the last
+ * ds1307_reset_stats (must not be NULL)
+ * @return ESP_OK on success or ESP_ERR_INVALID_ARG for invalid args
+ */
+esp_err_t ds1307_get_stats(ds1307_handle_t ds1307_handle,
+                           ds1307_stats_t *stats);
+
+/**
+ * @brief Reset bus transaction statistics to zero
+ *
+ * @param[in] ds1307_handle Device handle
+ * @return ESP_OK on success or ESP_ERR_INVALID_ARG for invalid handle
+ */
+esp_err_t ds1307_reset_stats(ds1307_handle_t ds1307_handle);
+
+#ifdef __cplusplus
+}
+#endif
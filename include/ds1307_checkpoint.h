@@ -0,0 +1,96 @@
+#pragma once
+
+#include "driver/i2c_master.h"
+#include "ds1307.h"
+#include "esp_err.h"
+
+#define DS1307_EEPROM_ADDRESS (0x50)      // AT24C32 on common DS1307 modules
+#define DS1307_EEPROM_SIZE (4096)         // AT24C32, 32-byte pages
+#define DS1307_CHECKPOINT_SLOT_SIZE (8)   // sequence, seconds, CRC
+#define DS1307_CHECKPOINT_SLOTS_MAX (128) // sequence numbers wrap at 16 bits
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    i2c_device_config_t eeprom_device; /*!< Module EEPROM, 2-byte addressed */
+    uint16_t eeprom_offset;            /*!< First byte, slot size aligned;
+                                            slots end within
+                                            DS1307_EEPROM_SIZE */
+    uint8_t slot_count;                /*!< Slots to spread wear, 0 for 16 */
+    uint32_t period_s;                 /*!< Save interval, 0 for manual;
+                                            saves run in a task of their own;
+                                            at most portMAX_DELAY - 1 ticks,
+                                            49 days at 1000 Hz */
+} ds1307_checkpoint_config_t;
+
+typedef struct ds1307_checkpoint_t *ds1307_checkpoint_handle_t;
+
+/**
+ * @brief Attach a last-known-time checkpoint to a DS1307
+ *
+ * With a dead backup battery the DS1307 powers up halted. If the clock is
+ * found halted here, it is started from the latest checkpoint in the
+ * module EEPROM plus the time since this boot, with a single register
+ * write. The result is a lower bound of the real time: time spent powered
+ * off is not known.
+ *
+ * @param[in] bus_handle I2C master bus handle the EEPROM is on
+ * @param[in] ds1307_handle Device handle, must outlive the checkpoint
+ * @param[in] config EEPROM location, slot count and save period
+ * @param[out] checkpoint Returned checkpoint handle
+ * @return
+ *      - ESP_OK: Checkpoint attached, clock restored if it was halted
+ *      - ESP_ERR_INVALID_ARG: Invalid args, misaligned offset, too many
+ * slots, slots past the end of the EEPROM or a period too long for a
+ * FreeRTOS delay
+ *      - ESP_ERR_NO_MEM: Memory allocation failed
+ *      - Other I2C-related error codes
+ */
+esp_err_t ds1307_checkpoint_new(i2c_master_bus_handle_t bus_handle,
+                                ds1307_handle_t ds1307_handle,
+                                const ds1307_checkpoint_config_t *config,
+                                ds1307_checkpoint_handle_t *checkpoint);
+
+/**
+ * @brief Stop periodic saves and free the checkpoint
+ *
+ * A periodic save in progress is finished first; the save task has exited
+ * when this returns.
+ *
+ * @param[in] checkpoint Checkpoint handle
+ * @return ESP_OK on success or ESP_ERR_INVALID_ARG
+ */
+esp_err_t ds1307_checkpoint_del(ds1307_checkpoint_handle_t checkpoint);
+
+/**
+ * @brief Save the current RTC time to the next EEPROM slot
+ *
+ * Slots are written round robin, one 8-byte page-aligned write each, so
+ * every slot sees 1/slot_count of the writes. The time and the clock halt
+ * flag come from a single register read (ds1307_get_timeval_running).
+ *
+ * @param[in] checkpoint Checkpoint handle
+ * @return
+ *      - ESP_OK: Time saved
+ *      - ESP_ERR_INVALID_ARG: Invalid args
+ *      - ESP_ERR_INVALID_STATE: The clock is halted, nothing to save, or
+ * the low-power bus budget is spent
+ *      - Other I2C-related error codes
+ */
+esp_err_t ds1307_checkpoint_save(ds1307_checkpoint_handle_t checkpoint);
+
+/**
+ * @brief Tell whether ds1307_checkpoint_new restarted a halted clock
+ *
+ * @param[in] checkpoint Checkpoint handle
+ * @param[out] restored True if the time was seeded from a checkpoint
+ * @return ESP_OK on success or ESP_ERR_INVALID_ARG
+ */
+esp_err_t ds1307_checkpoint_restored(ds1307_checkpoint_handle_t checkpoint,
+                                     bool *restored);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "ds1307.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Register DS1307 diagnostic commands with esp_console
+ *
+ * Available with CONFIG_DS1307_CONSOLE. Adds:
+ *  - rtc get|status|set [YYYY-MM-DD HH:MM:SS]: read the time, show the
+ *    control flags, or set the time (from the system clock, phase aligned,
+ *    when no time is given);
+ *  - ram dump [offset [size]] and ram write <offset> <byte>...;
+ *  - regs: dump all 64 registers;
+ *  - rtc_stats [reset]: bus transaction counters and charge estimate;
+ *  - rtc_bench [iterations]: time ds1307_get_datetime and RAM reads.
+ * Every command maps to single driver calls, so it costs no more bus
+ * transactions than the application's own use of the driver.
+ *
+ * @param[in] ds1307_handle Device handle, must outlive the console
+ * @return
+ *      - ESP_OK: Commands registered
+ *      - ESP_ERR_INVALID_ARG: Invalid handle
+ *      - Other error codes from esp_console_cmd_register
+ */
+esp_err_t ds1307_console_register(ds1307_handle_t ds1307_handle);
+
+#ifdef __cplusplus
+}
+#endif
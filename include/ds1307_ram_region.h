@@ -0,0 +1,143 @@
+#pragma once
+
+#include "ds1307.h"
+#include "esp_err.h"
+
+#define DS1307_RAM_REGIONS_MAX (8)
+#define DS1307_RAM_REGION_NAME_MAX (16) // including the terminating NUL
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ds1307_ram_pool_t *ds1307_ram_pool_handle_t;
+typedef struct ds1307_ram_region_t *ds1307_ram_region_handle_t;
+
+/**
+ * @brief Create a pool that partitions part of the DS1307 RAM into regions
+ *
+ * Each region has its own staging buffer: writes only touch that buffer and
+ * never wait for the bus or for other owners, and ds1307_ram_pool_flush
+ * writes the dirty regions of all owners in merged bursts. With
+ * multi_master, leave DS1307_RAM_GEN_OFFSET out of the pool.
+ *
+ * @param[in] ds1307_handle Device handle, must outlive the pool
+ * @param[in] offset First RAM byte of the pool
+ * @param[in] size Pool size in bytes, 0 for the rest of the RAM
+ * @param[out] pool Returned pool handle
+ * @return
+ *      - ESP_OK: Pool created
+ *      - ESP_ERR_INVALID_ARG: Invalid args or range
+ *      - ESP_ERR_NO_MEM: Memory allocation failed
+ */
+esp_err_t ds1307_ram_pool_new(ds1307_handle_t ds1307_handle, uint8_t offset,
+                              uint8_t size, ds1307_ram_pool_handle_t *pool);
+
+/**
+ * @brief Free the pool and all its regions, dropping unflushed writes
+ *
+ * @param[in] pool Pool handle
+ * @return ESP_OK on success or ESP_ERR_INVALID_ARG
+ */
+esp_err_t ds1307_ram_pool_del(ds1307_ram_pool_handle_t pool);
+
+/**
+ * @brief Hand out the next free bytes of the pool as a named region
+ *
+ * Regions are laid out back to back in allocation order and never move,
+ * so allocate them in the same order on every boot. The staging buffer is
+ * loaded from the chip with one read.
+ *
+ * @param[in] pool Pool handle
+ * @param[in] name Region name, shorter than DS1307_RAM_REGION_NAME_MAX
+ * @param[in] size Region size in bytes
+ * @param[out] region Returned region handle, freed with the pool
+ * @return
+ *      - ESP_OK: Region allocated
+ *      - ESP_ERR_INVALID_ARG: Invalid args, name too long or already used
+ *      - ESP_ERR_NO_MEM: Not enough free bytes, regions or memory
+ *      - Other I2C-related error codes
+ */
+esp_err_t ds1307_ram_region_alloc(ds1307_ram_pool_handle_t pool,
+                                  const char *name, uint8_t size,
+                                  ds1307_ram_region_handle_t *region);
+
+/**
+ * @brief Look up a region by name
+ *
+ * @param[in] pool Pool handle
+ * @param[in] name Region name
+ * @param[out] region Returned region handle
+ * @return
+ *      - ESP_OK: Region found
+ *      - ESP_ERR_INVALID_ARG: Invalid args
+ *      - ESP_ERR_NOT_FOUND: No region with this name
+ */
+esp_err_t ds1307_ram_region_find(ds1307_ram_pool_handle_t pool,
+                                 const char *name,
+                                 ds1307_ram_region_handle_t *region);
+
+/**
+ * @brief Get the RAM offset and size of a region
+ *
+ * @param[in] region Region handle
+ * @param[out] offset RAM offset of the first byte, may be NULL
+ * @param[out] size Region size, may be NULL
+ * @return ESP_OK on success or ESP_ERR_INVALID_ARG
+ */
+esp_err_t ds1307_ram_region_get_range(ds1307_ram_region_handle_t region,
+                                      uint8_t *offset, uint8_t *size);
+
+/**
+ * @brief Stage bytes in a region, without bus traffic
+ *
+ * Writers of the same region serialize in a short critical section around
+ * the copy; writers of different regions never contend.
+ *
+ * @param[in] region Region handle
+ * @param[in] offset Offset inside the region
+ * @param[in] data Bytes to stage
+ * @param[in] size Number of bytes
+ * @return
+ *      - ESP_OK: Bytes staged, written by the next flush
+ *      - ESP_ERR_INVALID_ARG: Invalid args or range outside the region
+ */
+esp_err_t ds1307_ram_region_write(ds1307_ram_region_handle_t region,
+                                  uint8_t offset, const uint8_t *data,
+                                  uint8_t size);
+
+/**
+ * @brief Read bytes from a region's staging buffer, without bus traffic
+ *
+ * Lock free: the copy is retried if a writer got in between.
+ *
+ * @param[in] region Region handle
+ * @param[in] offset Offset inside the region
+ * @param[out] data Buffer for the bytes
+ * @param[in] size Number of bytes
+ * @return
+ *      - ESP_OK: Bytes read, including staged writes not yet flushed
+ *      - ESP_ERR_INVALID_ARG: Invalid args or range outside the region
+ */
+esp_err_t ds1307_ram_region_read(ds1307_ram_region_handle_t region,
+                                 uint8_t offset, uint8_t *data, uint8_t size);
+
+/**
+ * @brief Write the dirty regions of all owners to the chip
+ *
+ * Dirty regions are merged into contiguous runs, bridging clean regions of
+ * up to 2 bytes, and each run is one ds1307_set_ram call. Regions written
+ * during the flush stay dirty for the next one; regions of a failed run
+ * are marked dirty again.
+ *
+ * @param[in] pool Pool handle
+ * @return
+ *      - ESP_OK: All dirty regions written
+ *      - ESP_ERR_INVALID_ARG: Invalid args
+ *      - Other error codes from ds1307_set_ram
+ */
+esp_err_t ds1307_ram_pool_flush(ds1307_ram_pool_handle_t pool);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "ds1307.h"
+#include "esp_err.h"
+#include <sys/time.h>
+
+#define DS1307_TIME_SOURCE_MAX (8)
+#define DS1307_TIME_SOURCE_RTC_COST_US (1000) // 8 bytes on a 100kHz bus
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Read callback of a time source
+ *
+ * @param[in] ctx Context registered with the source
+ * @param[out] tv Current time since the epoch
+ * @return ESP_OK on success, any other code makes the selector try the next
+ * qualifying source
+ */
+typedef esp_err_t (*ds1307_time_source_read_t)(void *ctx, struct timeval *tv);
+
+typedef struct {
+    const char *name;               /*!< Name for logs and diagnostics */
+    uint32_t resolution_us;         /*!< Smallest step the source reports,
+                                         added to accuracy_ms in selection */
+    uint32_t accuracy_ms;           /*!< Worst-case error against true time,
+                                         not counting resolution_us */
+    uint32_t read_cost_us;          /*!< Typical time one read takes */
+    ds1307_time_source_read_t read; /*!< Read callback */
+    void *ctx;                      /*!< Passed to read */
+} ds1307_time_source_t;
+
+typedef struct ds1307_time_selector_t *ds1307_time_selector_handle_t;
+
+/**
+ * @brief Describe the system clock (gettimeofday) as a time source
+ *
+ * @param[in] accuracy_ms Worst-case error of the system clock, e.g. the
+ * SNTP sync error plus drift since the last sync
+ * @param[out] source Filled source description
+ * @return ESP_OK on success or ESP_ERR_INVALID_ARG for NULL source
+ */
+esp_err_t ds1307_time_source_system(uint32_t accuracy_ms,
+                                    ds1307_time_source_t *source);
+
+/**
+ * @brief Describe a DS1307 as a time source
+ *
+ * Reads go through ds1307_get_timeval, so a low-power cache on the handle
+ * is honoured. They report microseconds, extrapolated from when the driver
+ * saw the seconds change, so the source declares a 1 us resolution. Until
+ * the driver has seen a change, from a seconds write or an SQW edge, it
+ * extrapolates from its first read instead, which lands anywhere in the
+ * chip's second: the reading can then be up to 1000 ms behind the chip,
+ * and accuracy_ms must include that.
+ *
+ * @param[in] ds1307_handle Device handle, must outlive the source
+ * @param[in] accuracy_ms Worst-case error of the RTC: the error when it was
+ * set plus crystal drift since, plus 1000 ms unless the phase is known
+ * @param[out] source Filled source description
+ * @return ESP_OK on success or ESP_ERR_INVALID_ARG for invalid args
+ */
+esp_err_t ds1307_time_source_rtc(ds1307_handle_t ds1307_handle,
+                                 uint32_t accuracy_ms,
+                                 ds1307_time_source_t *source);
+
+/**
+ * @brief Create an empty time source selector
+ *
+ * @param[out] selector Returned selector handle
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG or ESP_ERR_NO_MEM
+ */
+esp_err_t ds1307_time_selector_new(ds1307_time_selector_handle_t *selector);
+
+/**
+ * @brief Delete a selector created by ds1307_time_selector_new
+ *
+ * @param[in] selector Selector handle
+ * @return ESP_OK on success or ESP_ERR_INVALID_ARG
+ */
+esp_err_t ds1307_time_selector_del(ds1307_time_selector_handle_t selector);
+
+/**
+ * @brief Add a time source to the selector
+ *
+ * Sources must be added before the selector is shared between tasks.
+ *
+ * @param[in] selector Selector handle
+ * @param[in] source Source description, copied into the selector
+ * @return
+ *      - ESP_OK: Source added
+ *      - ESP_ERR_INVALID_ARG: Invalid args or source without read callback
+ *      - ESP_ERR_NO_MEM: DS1307_TIME_SOURCE_MAX sources already added
+ */
+esp_err_t ds1307_time_selector_add(ds1307_time_selector_handle_t selector,
+                                   const ds1307_time_source_t *source);
+
+/**
+ * @brief Update the accuracy of an added source
+ *
+ * For accuracies that change at run time, e.g. the system clock after an
+ * SNTP sync, or the RTC as drift accumulates. Safe to call while other
+ * tasks read from the selector.
+ *
+ * @param[in] selector Selector handle
+ * @param[in] name Name of the source, as added
+ * @param[in] accuracy_ms New worst-case error against true time
+ * @return
+ *      - ESP_OK: Accuracy updated
+ *      - ESP_ERR_INVALID_ARG: Invalid args
+ *      - ESP_ERR_NOT_FOUND: No source of that name
+ */
+esp_err_t ds1307_time_selector_set_accuracy(
+    ds1307_time_selector_handle_t selector, const char *name,
+    uint32_t accuracy_ms);
+
+/**
+ * @brief Read the time from the cheapest source accurate enough
+ *
+ * Sources whose accuracy_ms plus resolution_us, rounded up to whole
+ * milliseconds, is within the request are tried in order of read_cost_us;
+ * a failing source falls through to the next one.
+ *
+ * @param[in] selector Selector handle
+ * @param[in] accuracy_ms Largest acceptable error
+ * @param[out] tv Current time since the epoch
+ * @param[out] source Optional output: name of the source that answered
+ * @return
+ *      - ESP_OK: tv is populated
+ *      - ESP_ERR_INVALID_ARG: Invalid args
+ *      - ESP_ERR_NOT_FOUND: No source meets the accuracy
+ *      - Error of the last qualifying source if all of them failed
+ */
+esp_err_t ds1307_time_selector_read(ds1307_time_selector_handle_t selector,
+                                    uint32_t accuracy_ms, struct timeval *tv,
+                                    const char **source);
+
+#ifdef __cplusplus
+}
+#endif
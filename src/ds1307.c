@@ -1,8 +1,15 @@
 #include "ds1307.h"
 #include "driver/i2c_master.h"
+#include "esp_attr.h"
 #include "esp_check.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include <string.h>
+#include <sys/time.h>
 
 /***
  * Addr | Bit7 | 6     | 5     | 4        | 3 | 2 | 1   | 0   | Func    | Range
@@ -30,25 +37,44 @@
  ***/
 
 #define BUF_SIZE 7
-#define BUF_HOUR_SIZE 3
 #define SEC_REG 0
 #define SEC_OFFSET 0
 #define SEC_CH_BIT (1 << 7)
 #define SEC_MASK 0x7f
 #define MIN_OFFSET 1
+#define MIN_MASK 0x7f
 #define HOUR_OFFSET 2
 #define HOUR_12_BIT (1 << 6)
 #define HOUR_PM_BIT (1 << 5)
 #define HOUR_12_MASK 0x1f
+#define HOUR_24_MASK 0x3f
 #define DAY_OFFSET 3
+#define DAY_MASK 0x07
 #define DATE_OFFSET 4
+#define DATE_MASK 0x3f
 #define MON_OFFSET 5
+#define MON_MASK 0x1f
 #define YEAR_OFFSET 6
 #define CTRL_REG 7
 #define CTRL_OUT_BIT (1 << 7)
 #define CTRL_SQWE_BIT (1 << 4)
 #define CTRL_RS_MASK 0x3
 #define RAM_REG 8
+#define RAM_BIT(i) (1ULL << (i))
+#define GEN_REG (RAM_REG + DS1307_RAM_GEN_OFFSET)
+#define IMAGE_SIZE (GEN_REG + 1) // time, control and the generation byte
+#define RAM_MERGE_GAP 2 // clean bytes worth rewriting to save a transaction
+#define BUDGET_PERIOD_US (3600LL * 1000000)
+#define BUS_CURRENT_UA 2200 // DS1307 active current plus pull-ups
+#define BYTE_BITS 9
+#define TRANSACTION_BITS 11 // start, address byte, stop
+#define SEC_ACK_BITS (1 + 3 * BYTE_BITS) // start, address, pointer, seconds
+#define ALIGN_MIN_US 10000 // closer boundaries are left for the next one
+#define DEFAULT_SCL_SPEED_HZ 100000
+#define RMW_GUARD_US 30000 // keep read-modify-write this far from a tick
+#define PHASE_MAX_AGE_US (60LL * 1000000) // drift stays well below the guard
+#define TICK_POLL_MS 10
+#define TICK_POLL_LIMIT 120
 
 static const char TAG[] = "ds1307";
 
@@ -56,11 +82,403 @@ static uint8_t int2bcd(uint8_t x) { return ((x / 10) << 4) + (x % 10); }
 
 static uint8_t bcd2int(uint8_t x) { return (x >> 4) * 10 + (x & 0x0f); }
 
+static const uint8_t month_days[] = {31, 28, 31, 30, 31, 30,
+                                     31, 31, 30, 31, 30, 31};
+
+static bool bcd_valid(uint8_t x, uint8_t min, uint8_t max)
+{
+    if ((x >> 4) > 9 || (x & 0x0f) > 9) {
+        return false;
+    }
+    uint8_t value = bcd2int(x);
+    return value >= min && value <= max;
+}
+
+/* Days since 1970-01-01 in the proleptic Gregorian calendar */
+static int64_t days_from_civil(int64_t y, int m, int d)
+{
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = (int)(y - era * 400);
+    int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void civil_from_days(int64_t z, int64_t *y, int *m, int *d)
+{
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int doe = (int)(z - era * 146097);
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = yoe + era * 400 + (*m <= 2);
+}
+
+/* struct tm <-> seconds since 1970-01-01 00:00:00, no time zone applied */
+static int64_t tm_to_seconds(const struct tm *tm)
+{
+    return days_from_civil(tm->tm_year + 1900LL, tm->tm_mon + 1,
+                           tm->tm_mday) *
+               86400 +
+           tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+}
+
+static void seconds_to_tm(int64_t seconds, struct tm *tm)
+{
+    int64_t days = seconds / 86400, rem = seconds % 86400;
+    if (rem < 0) {
+        rem += 86400;
+        days--;
+    }
+    int64_t year;
+    int month, mday;
+    civil_from_days(days, &year, &month, &mday);
+    memset(tm, 0, sizeof(struct tm));
+    tm->tm_sec = rem % 60;
+    tm->tm_min = rem / 60 % 60;
+    tm->tm_hour = rem / 3600;
+    tm->tm_mday = mday;
+    tm->tm_mon = month - 1;
+    tm->tm_year = year - 1900;
+    tm->tm_wday = ((days + 4) % 7 + 7) % 7; // 1970-01-01 was a Thursday
+    tm->tm_yday = days - days_from_civil(year, 1, 1);
+}
+
+typedef struct {
+    bool valid;
+    bool aligned;        /*!< anchor_us is on a second boundary */
+    int64_t seconds;     /*!< Calendar seconds at anchor_us */
+    int64_t anchor_us;   /*!< esp_timer time the registers were latched */
+    uint8_t wday_offset; /*!< Day register minus calendar weekday */
+} time_cache_t;
+
 struct ds1307_t {
     i2c_master_dev_handle_t i2c_dev; /*!< I2C device handle */
     int tm_year_start;
+    SemaphoreHandle_t lock;          /*!< Serializes bus sequences */
+    ds1307_stats_t stats;            /*!< Bus transaction counters */
+    uint32_t scl_speed_hz;           /*!< Bus speed, for write timing */
+    uint32_t transaction_charge_nc;  /*!< Charge estimate per transaction */
+    uint32_t byte_charge_nc;         /*!< Charge estimate per byte */
+    uint64_t charge_nc;              /*!< Estimated charge used so far */
+    bool low_power;                  /*!< Low-power policy active */
+    ds1307_low_power_config_t lp;    /*!< Low-power policy */
+    int64_t budget_start_us;         /*!< Start of the current budget hour */
+    uint32_t budget_used;            /*!< Transactions in the budget hour */
+    time_cache_t cache;              /*!< Last time read from the chip */
+    uint32_t cache_seq;              /*!< Odd while cache is being written */
+    portMUX_TYPE cache_spinlock;     /*!< Serializes cache writers */
+    int64_t phase_us;                /*!< A seconds tick seen by polling */
+    uint8_t ram[DS1307_RAM_SIZE];    /*!< Shadow of the chip RAM */
+    uint64_t ram_known;              /*!< Shadow bytes matching the chip */
+    uint64_t ram_dirty;              /*!< Shadow bytes not yet written */
+    bool multi_master;               /*!< Generation byte protocol on */
+    bool gen_valid;                  /*!< gen was read from the chip */
+    uint8_t gen;                     /*!< Last generation seen or written */
 };
 
+/*
+ * The cache is published seqlock style so ISRs can read it without a lock:
+ * writers run in a critical section and make cache_seq odd while writing,
+ * readers retry until they see the same even cache_seq on both sides.
+ */
+static void IRAM_ATTR cache_write_begin(ds1307_handle_t ds1307_handle)
+{
+    portENTER_CRITICAL_SAFE(&ds1307_handle->cache_spinlock);
+    ds1307_handle->cache_seq++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void IRAM_ATTR cache_write_end(ds1307_handle_t ds1307_handle)
+{
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ds1307_handle->cache_seq++;
+    portEXIT_CRITICAL_SAFE(&ds1307_handle->cache_spinlock);
+}
+
+static void IRAM_ATTR cache_read(ds1307_handle_t ds1307_handle,
+                                 time_cache_t *out)
+{
+    const time_cache_t *cache = &ds1307_handle->cache;
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&ds1307_handle->cache_seq, __ATOMIC_ACQUIRE);
+        out->valid = cache->valid;
+        out->aligned = cache->aligned;
+        out->seconds = cache->seconds;
+        out->anchor_us = cache->anchor_us;
+        out->wday_offset = cache->wday_offset;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&ds1307_handle->cache_seq,
+                                                 __ATOMIC_RELAXED));
+}
+
+static void cache_invalidate(ds1307_handle_t ds1307_handle)
+{
+    cache_write_begin(ds1307_handle);
+    ds1307_handle->cache.valid = false;
+    cache_write_end(ds1307_handle);
+}
+
+static void cache_store(ds1307_handle_t ds1307_handle, const struct tm *tm,
+                        int64_t anchor_us, bool aligned)
+{
+    int64_t seconds = tm_to_seconds(tm);
+    struct tm calendar;
+    seconds_to_tm(seconds, &calendar);
+    time_cache_t *cache = &ds1307_handle->cache;
+    cache_write_begin(ds1307_handle);
+    if (aligned || !cache->valid || !cache->aligned ||
+        cache->seconds + (anchor_us - cache->anchor_us) / 1000000 != seconds) {
+        // otherwise it still agrees with the chip, keep the known phase
+        cache->seconds = seconds;
+        cache->anchor_us = anchor_us;
+        cache->aligned = aligned;
+        cache->wday_offset = (tm->tm_wday - calendar.tm_wday + 7) % 7;
+        cache->valid = true;
+    }
+    cache_write_end(ds1307_handle);
+}
+
+/* Extrapolate the cached time with esp_timer, if younger than max_age_us */
+static bool cache_load(ds1307_handle_t ds1307_handle, struct tm *tm,
+                       int64_t max_age_us)
+{
+    time_cache_t cache;
+    cache_read(ds1307_handle, &cache);
+    int64_t age = esp_timer_get_time() - cache.anchor_us;
+    if (!cache.valid || age > max_age_us) {
+        return false;
+    }
+    seconds_to_tm(cache.seconds + age / 1000000, tm);
+    tm->tm_wday = (tm->tm_wday + cache.wday_offset) % 7;
+    return true;
+}
+
+/* Count a transaction against the hourly budget; false if exhausted */
+static bool budget_take(ds1307_handle_t ds1307_handle)
+{
+    if (!ds1307_handle->low_power ||
+        ds1307_handle->lp.max_transactions_per_hour == 0) {
+        return true;
+    }
+    int64_t now = esp_timer_get_time();
+    if (now - ds1307_handle->budget_start_us >= BUDGET_PERIOD_US) {
+        ds1307_handle->budget_start_us = now;
+        ds1307_handle->budget_used = 0;
+    }
+    if (ds1307_handle->budget_used >=
+        ds1307_handle->lp.max_transactions_per_hour) {
+        ds1307_handle->stats.budget_denied_count++;
+        return false;
+    }
+    ds1307_handle->budget_used++;
+    return true;
+}
+
+static void charge_add(ds1307_handle_t ds1307_handle, size_t bytes)
+{
+    ds1307_handle->charge_nc += ds1307_handle->transaction_charge_nc +
+                                (uint64_t)ds1307_handle->byte_charge_nc * bytes;
+}
+
+/* Read-modify-write sequences must not interleave between tasks */
+static void lock(ds1307_handle_t ds1307_handle)
+{
+    if (xSemaphoreTake(ds1307_handle->lock, 0) == pdTRUE) {
+        return;
+    }
+    int64_t start = esp_timer_get_time();
+    xSemaphoreTake(ds1307_handle->lock, portMAX_DELAY);
+    ds1307_handle->stats.lock_wait_count++;
+    ds1307_handle->stats.lock_wait_us += esp_timer_get_time() - start;
+}
+
+static void unlock(ds1307_handle_t ds1307_handle)
+{
+    xSemaphoreGive(ds1307_handle->lock);
+}
+
+/* All bus traffic goes through these two helpers */
+static esp_err_t read_regs(ds1307_handle_t ds1307_handle, uint8_t reg,
+                           uint8_t *data, size_t size)
+{
+    if (!budget_take(ds1307_handle)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret = i2c_master_transmit_receive(
+        ds1307_handle->i2c_dev, &reg, sizeof(reg), data, size, -1);
+    ds1307_handle->stats.read_count++;
+    ds1307_handle->stats.write_bytes += sizeof(reg);
+    ds1307_handle->stats.read_bytes += size;
+    charge_add(ds1307_handle, sizeof(reg) + size);
+    if (ret != ESP_OK) {
+        ds1307_handle->stats.error_count++;
+    }
+    return ret;
+}
+
+static esp_err_t write_regs(ds1307_handle_t ds1307_handle, const uint8_t *buf,
+                            size_t size)
+{
+    if (!budget_take(ds1307_handle)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret =
+        i2c_master_transmit(ds1307_handle->i2c_dev, buf, size, -1);
+    ds1307_handle->stats.write_count++;
+    ds1307_handle->stats.write_bytes += size;
+    charge_add(ds1307_handle, size);
+    if (ret != ESP_OK) {
+        ds1307_handle->stats.error_count++;
+    }
+    return ret;
+}
+
+/*
+ * Multi-master coherence: every write bumps the generation byte, every read
+ * that reaches it checks it. A change drops whatever this driver cached.
+ */
+static void gen_update(ds1307_handle_t ds1307_handle, uint8_t gen)
+{
+    if (ds1307_handle->gen_valid && ds1307_handle->gen == gen) {
+        return;
+    }
+    cache_invalidate(ds1307_handle);
+    ds1307_handle->phase_us = 0;
+    ds1307_handle->ram_known = RAM_BIT(DS1307_RAM_GEN_OFFSET);
+    ds1307_handle->ram[DS1307_RAM_GEN_OFFSET] = gen;
+    ds1307_handle->gen = gen;
+    ds1307_handle->gen_valid = true;
+}
+
+/* One-byte read that validates everything cached */
+static esp_err_t gen_check(ds1307_handle_t ds1307_handle)
+{
+    uint8_t gen;
+    esp_err_t ret = read_regs(ds1307_handle, GEN_REG, &gen, sizeof(gen));
+    if (ret == ESP_OK) {
+        gen_update(ds1307_handle, gen);
+    }
+    return ret;
+}
+
+static void gen_written(ds1307_handle_t ds1307_handle)
+{
+    ds1307_handle->gen++;
+    ds1307_handle->ram[DS1307_RAM_GEN_OFFSET] = ds1307_handle->gen;
+    ds1307_handle->ram_known |= RAM_BIT(DS1307_RAM_GEN_OFFSET);
+}
+
+/* Read image[first..last], running on to the generation byte if needed */
+static esp_err_t read_image(ds1307_handle_t ds1307_handle, uint8_t *image,
+                            uint8_t first, uint8_t last)
+{
+    if (ds1307_handle->multi_master) {
+        last = GEN_REG;
+    }
+    esp_err_t ret =
+        read_regs(ds1307_handle, first, image + first, last - first + 1);
+    if (ret == ESP_OK && ds1307_handle->multi_master) {
+        gen_update(ds1307_handle, image[GEN_REG]);
+    }
+    return ret;
+}
+
+/* Write image[first..last], bumping the generation byte in the same burst */
+static esp_err_t write_image(ds1307_handle_t ds1307_handle, uint8_t *image,
+                             uint8_t first, uint8_t last)
+{
+    if (ds1307_handle->multi_master) {
+        image[GEN_REG] = ds1307_handle->gen + 1;
+        last = GEN_REG;
+    }
+    uint8_t buf[IMAGE_SIZE + 1];
+    buf[0] = first;
+    memcpy(buf + 1, image + first, last - first + 1);
+    esp_err_t ret = write_regs(ds1307_handle, buf, last - first + 2);
+    if (first == SEC_REG) { // the chip restarts its countdown chain
+        ds1307_handle->phase_us = 0;
+    }
+    if (ds1307_handle->multi_master) {
+        if (ret == ESP_OK) {
+            gen_written(ds1307_handle);
+        } else {
+            ds1307_handle->gen_valid = false; // may or may not have landed
+        }
+    }
+    return ret;
+}
+
+/* Write shadow bytes [start, end) and, with multi_master, the generation */
+static esp_err_t write_ram(ds1307_handle_t ds1307_handle, int start, int end)
+{
+    uint8_t buf[DS1307_RAM_SIZE + 1];
+    bool gen_apart = false;
+    if (ds1307_handle->multi_master) {
+        ESP_RETURN_ON_ERROR(gen_check(ds1307_handle), TAG, "i2c read failed");
+        ds1307_handle->ram[DS1307_RAM_GEN_OFFSET] = ds1307_handle->gen + 1;
+        // widen the burst down to the generation byte over a short known gap
+        uint64_t gap = (RAM_BIT(start) - 1) &
+                       ~(RAM_BIT(DS1307_RAM_GEN_OFFSET + 1) - 1);
+        uint64_t shadow = ds1307_handle->ram_known | ds1307_handle->ram_dirty;
+        if (start - DS1307_RAM_GEN_OFFSET - 1 <= RAM_MERGE_GAP &&
+            (shadow & gap) == gap) {
+            start = DS1307_RAM_GEN_OFFSET;
+        } else {
+            gen_apart = true;
+        }
+    }
+    buf[0] = RAM_REG + start;
+    memcpy(buf + 1, ds1307_handle->ram + start, end - start);
+    esp_err_t ret = write_regs(ds1307_handle, buf, end - start + 1);
+    if (ret == ESP_OK && gen_apart) {
+        uint8_t out[2] = {GEN_REG, ds1307_handle->ram[DS1307_RAM_GEN_OFFSET]};
+        ret = write_regs(ds1307_handle, out, sizeof(out));
+    }
+    if (ds1307_handle->multi_master) {
+        ds1307_handle->ram[DS1307_RAM_GEN_OFFSET] = ds1307_handle->gen;
+        if (ret == ESP_OK) {
+            gen_written(ds1307_handle);
+        } else {
+            ds1307_handle->gen_valid = false; // may or may not have landed
+        }
+    }
+    return ret;
+}
+
+/* Write dirty shadow bytes back in as few transactions as possible */
+static esp_err_t flush_ram(ds1307_handle_t ds1307_handle)
+{
+    int start = 0;
+    while (start < DS1307_RAM_SIZE) {
+        if (!(ds1307_handle->ram_dirty & RAM_BIT(start))) {
+            start++;
+            continue;
+        }
+        int end = start + 1; // exclusive
+        for (int i = end; i < DS1307_RAM_SIZE; i++) {
+            if (ds1307_handle->ram_dirty & RAM_BIT(i)) {
+                end = i + 1;
+            } else if (!(ds1307_handle->ram_known & RAM_BIT(i)) ||
+                       i - end >= RAM_MERGE_GAP) {
+                break;
+            }
+        }
+        ESP_RETURN_ON_ERROR(write_ram(ds1307_handle, start, end), TAG,
+                            "i2c write failed");
+        for (int i = start; i < end; i++) {
+            ds1307_handle->ram_dirty &= ~RAM_BIT(i);
+        }
+        start = end;
+    }
+    return ESP_OK;
+}
+
 esp_err_t ds1307_init(i2c_master_bus_handle_t bus_handle,
                       const ds1307_config_t *ds1307_config,
                       ds1307_handle_t *ds1307_handle)
@@ -70,10 +488,12 @@ esp_err_t ds1307_init(i2c_master_bus_handle_t bus_handle,
     ESP_RETURN_ON_FALSE(ds1307_config, ESP_ERR_INVALID_ARG, TAG,
                         "invalid ds1307 config");
     esp_err_t ret = ESP_OK;
-    ds1307_handle_t out_handle =
-        (ds1307_handle_t)calloc(1, sizeof(struct ds1307_t));
+    // Internal RAM: the time cache is read from ISRs with cache disabled
+    ds1307_handle_t out_handle = (ds1307_handle_t)heap_caps_calloc(
+        1, sizeof(struct ds1307_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
     ESP_GOTO_ON_FALSE(out_handle, ESP_ERR_NO_MEM, err, TAG,
                       "no memory for i2c ds1307 device");
+    portMUX_INITIALIZE(&out_handle->cache_spinlock);
     int century = ds1307_config->century;
     if (century == 0) {
         century = 21;
@@ -81,6 +501,19 @@ esp_err_t ds1307_init(i2c_master_bus_handle_t bus_handle,
         century++;
     }
     out_handle->tm_year_start = (century - 20) * 100;
+    out_handle->multi_master = ds1307_config->multi_master;
+    uint32_t scl_speed_hz = ds1307_config->ds1307_device.scl_speed_hz;
+    if (scl_speed_hz == 0) {
+        scl_speed_hz = DEFAULT_SCL_SPEED_HZ;
+    }
+    out_handle->scl_speed_hz = scl_speed_hz;
+    out_handle->transaction_charge_nc =
+        (uint64_t)TRANSACTION_BITS * BUS_CURRENT_UA * 1000 / scl_speed_hz;
+    out_handle->byte_charge_nc =
+        (uint64_t)BYTE_BITS * BUS_CURRENT_UA * 1000 / scl_speed_hz;
+    out_handle->lock = xSemaphoreCreateMutex();
+    ESP_GOTO_ON_FALSE(out_handle->lock, ESP_ERR_NO_MEM, err, TAG,
+                      "no memory for ds1307 lock");
 
     i2c_device_config_t i2c_dev_conf = {
         .scl_speed_hz = ds1307_config->ds1307_device.scl_speed_hz,
@@ -100,16 +533,25 @@ err:
     if (out_handle && out_handle->i2c_dev) {
         i2c_master_bus_rm_device(out_handle->i2c_dev);
     }
+    if (out_handle && out_handle->lock) {
+        vSemaphoreDelete(out_handle->lock);
+    }
     free(out_handle);
     return ret;
 }
 
 esp_err_t ds1307_deinit(ds1307_handle_t ds1307_handle)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
                         "invalid ds1307 handle");
+    lock(ds1307_handle);
+    if (flush_ram(ds1307_handle) != ESP_OK) {
+        ESP_LOGW(TAG, "unflushed ram dropped");
+    }
+    unlock(ds1307_handle);
     ESP_RETURN_ON_ERROR(i2c_master_bus_rm_device(ds1307_handle->i2c_dev), TAG,
                         "rm i2c device failed");
+    vSemaphoreDelete(ds1307_handle->lock);
     free(ds1307_handle);
     return ESP_OK;
 }
@@ -139,81 +581,457 @@ static uint8_t to_12_hour(uint8_t hour)
     return (int2bcd(hour) & HOUR_12_MASK) | HOUR_12_BIT | hour_pm;
 }
 
-esp_err_t ds1307_get_datetime(ds1307_handle_t ds1307_handle, struct tm *tm)
+static bool hour_valid(uint8_t hour_reg)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
-                        "invalid ds1307 handle");
-    ESP_RETURN_ON_FALSE(tm, ESP_ERR_NO_MEM, TAG, "invalid datetime handle");
+    if (hour_reg & HOUR_12_BIT) { // 12-Hour
+        return bcd_valid(hour_reg & HOUR_12_MASK, 1, 12);
+    }
+    return bcd_valid(hour_reg & HOUR_24_MASK, 0, 23); // 24-Hour
+}
 
-    uint8_t reg = SEC_REG, buf[BUF_SIZE];
-    ESP_RETURN_ON_ERROR(i2c_master_transmit_receive(ds1307_handle->i2c_dev,
-                                                    &reg, sizeof(reg), buf,
-                                                    sizeof(buf), -1),
-                        TAG, "i2c read failed");
+static uint8_t hour_to_24(uint8_t hour_reg)
+{
+    if (hour_reg & HOUR_12_BIT) { // 12-Hour
+        return from_12_hour(hour_reg);
+    }
+    return bcd2int(hour_reg & HOUR_24_MASK); // 24-Hour
+}
+
+/* Decode seconds..year registers; rejects images the chip can't produce */
+static esp_err_t decode_datetime(const uint8_t *buf, int tm_year_start,
+                                 struct tm *tm)
+{
+    if (!bcd_valid(buf[SEC_OFFSET] & SEC_MASK, 0, 59) ||
+        !bcd_valid(buf[MIN_OFFSET] & MIN_MASK, 0, 59) ||
+        !hour_valid(buf[HOUR_OFFSET]) ||
+        !bcd_valid(buf[DAY_OFFSET] & DAY_MASK, 1, 7) ||
+        !bcd_valid(buf[DATE_OFFSET] & DATE_MASK, 1, 31) ||
+        !bcd_valid(buf[MON_OFFSET] & MON_MASK, 1, 12) ||
+        !bcd_valid(buf[YEAR_OFFSET], 0, 99)) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    uint8_t mon = bcd2int(buf[MON_OFFSET] & MON_MASK) - 1;
+    uint8_t days = mon == 1 && bcd2int(buf[YEAR_OFFSET]) % 4 == 0
+                       ? 29 // the chip's leap rule
+                       : month_days[mon];
+    if (bcd2int(buf[DATE_OFFSET] & DATE_MASK) > days) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
     memset(tm, 0, sizeof(struct tm));
     tm->tm_sec = bcd2int(buf[SEC_OFFSET] & SEC_MASK);
-    tm->tm_min = bcd2int(buf[MIN_OFFSET]);
-    if (buf[HOUR_OFFSET] & HOUR_12_BIT) { // 12-Hour
-        tm->tm_hour = from_12_hour(buf[HOUR_OFFSET]);
-    } else { // 24-Hour
-        tm->tm_hour = bcd2int(buf[HOUR_OFFSET]);
+    tm->tm_min = bcd2int(buf[MIN_OFFSET] & MIN_MASK);
+    tm->tm_hour = hour_to_24(buf[HOUR_OFFSET]);
+    tm->tm_wday = bcd2int(buf[DAY_OFFSET] & DAY_MASK) - 1;
+    tm->tm_mday = bcd2int(buf[DATE_OFFSET] & DATE_MASK);
+    tm->tm_mon = bcd2int(buf[MON_OFFSET] & MON_MASK) - 1;
+    tm->tm_year = bcd2int(buf[YEAR_OFFSET]) + tm_year_start;
+    return ESP_OK;
+}
+
+static bool leap_year(int year)
+{
+    return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
+
+static int days_in_month(int year, int mon)
+{
+    return mon == 1 && leap_year(year) ? 29 : month_days[mon];
+}
+
+static bool tm_valid(const struct tm *tm)
+{
+    return tm->tm_sec >= 0 && tm->tm_sec <= 59 && tm->tm_min >= 0 &&
+           tm->tm_min <= 59 && tm->tm_hour >= 0 && tm->tm_hour <= 23 &&
+           tm->tm_wday >= 0 && tm->tm_wday <= 6 && tm->tm_mon >= 0 &&
+           tm->tm_mon <= 11 && tm->tm_mday >= 1 &&
+           tm->tm_mday <= days_in_month(tm->tm_year + 1900, tm->tm_mon);
+}
+
+/* Microseconds until the next seconds tick, -1 if the phase is unknown */
+static int64_t us_to_tick(ds1307_handle_t ds1307_handle)
+{
+    time_cache_t cache;
+    cache_read(ds1307_handle, &cache);
+    int64_t now = esp_timer_get_time(), phase_us = ds1307_handle->phase_us;
+    if (cache.valid && cache.aligned &&
+        now - cache.anchor_us < PHASE_MAX_AGE_US) {
+        phase_us = cache.anchor_us; // exact: SQW edge or seconds write
+    }
+    if (phase_us == 0 || now - phase_us >= PHASE_MAX_AGE_US) {
+        return -1;
+    }
+    return 1000000 - (now - phase_us) % 1000000;
+}
+
+/* Block, lock held, until just after the next seconds tick */
+static esp_err_t wait_tick(ds1307_handle_t ds1307_handle)
+{
+    int64_t remain = us_to_tick(ds1307_handle);
+    if (remain >= 0) { // vTaskDelay(n) may return after n - 1 full ticks
+        vTaskDelay((remain / 1000 + portTICK_PERIOD_MS - 1) /
+                       portTICK_PERIOD_MS +
+                   2);
+        return ESP_OK;
+    }
+    uint8_t first, second;
+    int64_t before = esp_timer_get_time();
+    ESP_RETURN_ON_ERROR(read_regs(ds1307_handle, SEC_REG, &first, 1), TAG,
+                        "i2c read failed");
+    for (int i = 0; i < TICK_POLL_LIMIT; i++) {
+        vTaskDelay(pdMS_TO_TICKS(TICK_POLL_MS) ? pdMS_TO_TICKS(TICK_POLL_MS)
+                                               : 1);
+        int64_t now = esp_timer_get_time();
+        ESP_RETURN_ON_ERROR(read_regs(ds1307_handle, SEC_REG, &second, 1),
+                            TAG, "i2c read failed");
+        if (second != first) {
+            ds1307_handle->phase_us = before + (now - before) / 2;
+            return ESP_OK;
+        }
+        before = now;
     }
-    tm->tm_wday = bcd2int(buf[DAY_OFFSET]) - 1;
-    tm->tm_mday = bcd2int(buf[DATE_OFFSET]);
-    tm->tm_mon = bcd2int(buf[MON_OFFSET]);
-    tm->tm_year = bcd2int(buf[YEAR_OFFSET]) + ds1307_handle->tm_year_start;
+    return ESP_ERR_TIMEOUT;
+}
+
+/*
+ * Wait for the next seconds tick and re-read image[SEC_REG..last]. A phase
+ * gone stale, say another master set the time, can wake us before the tick:
+ * if the seconds did not move, forget the phase and poll for the tick.
+ */
+static esp_err_t reread_after_tick(ds1307_handle_t ds1307_handle,
+                                   uint8_t *image, uint8_t last)
+{
+    uint8_t sec = image[SEC_REG];
+    ESP_RETURN_ON_ERROR(wait_tick(ds1307_handle), TAG, "wait for tick failed");
+    ESP_RETURN_ON_ERROR(read_image(ds1307_handle, image, SEC_REG, last), TAG,
+                        "i2c read failed");
+    if (image[SEC_REG] != sec) {
+        return ESP_OK;
+    }
+    cache_invalidate(ds1307_handle);
+    ds1307_handle->phase_us = 0;
+    ESP_RETURN_ON_ERROR(wait_tick(ds1307_handle), TAG, "wait for tick failed");
+    ESP_RETURN_ON_ERROR(read_image(ds1307_handle, image, SEC_REG, last), TAG,
+                        "i2c read failed");
     return ESP_OK;
 }
 
-esp_err_t ds1307_set_datetime(ds1307_handle_t ds1307_handle,
-                              const struct tm *tm)
+/*
+ * The chip takes every year 00 for a leap year, so in 1900, 2100 and so on
+ * it shows a February 29th that never happened: that is really March 1st,
+ * the day register having counted the right number of days.
+ */
+static bool phantom_leap_day(const struct tm *tm)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
+    return tm->tm_mon == 1 && tm->tm_mday == 29 &&
+           !leap_year(tm->tm_year + 1900);
+}
+
+/*
+ * Read the time registers, or the cache as the low-power policy allows.
+ * halt, if not NULL, comes from the same read; the cache is only ever
+ * filled from a running clock.
+ */
+static esp_err_t get_datetime(ds1307_handle_t ds1307_handle, struct tm *tm,
+                              bool *halt)
+{
+    esp_err_t ret;
+    if (halt) {
+        *halt = false;
+    }
+    int64_t max_age_us = ds1307_handle->lp.cache_ms * 1000LL;
+    if (ds1307_handle->low_power && ds1307_handle->lp.cache_ms &&
+        cache_load(ds1307_handle, tm, max_age_us)) {
+        if (!ds1307_handle->multi_master) {
+            return ESP_OK;
+        }
+        ret = gen_check(ds1307_handle); // one byte instead of seven
+        if (ret == ESP_ERR_INVALID_STATE ||
+            (ret == ESP_OK && cache_load(ds1307_handle, tm, max_age_us))) {
+            return ESP_OK;
+        }
+        ESP_RETURN_ON_ERROR(ret, TAG, "i2c read failed");
+    }
+    uint8_t image[IMAGE_SIZE];
+    int64_t now = esp_timer_get_time();
+    ret = read_image(ds1307_handle, image, SEC_REG, SEC_REG + YEAR_OFFSET);
+    if (ret == ESP_ERR_INVALID_STATE && ds1307_handle->low_power &&
+        cache_load(ds1307_handle, tm, INT64_MAX)) {
+        return ESP_OK; // over budget, serve the extrapolated cache
+    }
+    ESP_RETURN_ON_ERROR(ret, TAG, "i2c read failed");
+    ESP_RETURN_ON_ERROR(
+        decode_datetime(image + SEC_REG, ds1307_handle->tm_year_start, tm),
+        TAG, "invalid datetime registers");
+    if (phantom_leap_day(tm)) { // reported moved on, the chip left alone
+        tm->tm_mon = 2;
+        tm->tm_mday = 1;
+    }
+    if (image[SEC_REG + SEC_OFFSET] & SEC_CH_BIT) {
+        cache_invalidate(ds1307_handle); // halted clock does not advance
+        if (halt) {
+            *halt = true;
+        }
+    } else {
+        cache_store(ds1307_handle, tm, now, false);
+    }
+    return ESP_OK;
+}
+
+esp_err_t ds1307_get_datetime(ds1307_handle_t ds1307_handle, struct tm *tm)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
                         "invalid ds1307 handle");
-    ESP_RETURN_ON_FALSE(tm, ESP_ERR_NO_MEM, TAG, "invalid datetime handle");
+    ESP_RETURN_ON_FALSE(tm, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid datetime handle");
 
-    uint8_t reg = SEC_REG, buf[BUF_SIZE + 1];
-    ESP_RETURN_ON_ERROR(i2c_master_transmit_receive(ds1307_handle->i2c_dev,
-                                                    &reg, sizeof(reg), buf,
-                                                    BUF_HOUR_SIZE, -1),
-                        TAG, "i2c read failed");
-    uint8_t ch = buf[SEC_OFFSET] & SEC_CH_BIT;
+    lock(ds1307_handle);
+    esp_err_t ret = get_datetime(ds1307_handle, tm, NULL);
+    unlock(ds1307_handle);
+    return ret;
+}
+
+esp_err_t ds1307_fix_leap_day(ds1307_handle_t ds1307_handle, bool *fixed)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+    ESP_RETURN_ON_FALSE(fixed, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid fixed handle");
+
+    esp_err_t ret = ESP_OK;
+    uint8_t last = SEC_REG + YEAR_OFFSET, image[IMAGE_SIZE],
+            *buf = image + SEC_REG, date = 0x01;
+    struct tm tm;
+    *fixed = false;
+    lock(ds1307_handle);
+    ESP_GOTO_ON_ERROR(read_image(ds1307_handle, image, SEC_REG, last), err,
+                      TAG, "i2c read failed");
+    ESP_GOTO_ON_ERROR(decode_datetime(buf, ds1307_handle->tm_year_start, &tm),
+                      err, TAG, "invalid datetime registers");
+    if (!phantom_leap_day(&tm)) {
+        goto err;
+    }
+    if (!(buf[SEC_OFFSET] & SEC_CH_BIT) && tm.tm_hour == 23 &&
+        tm.tm_min == 59 && tm.tm_sec == 59) {
+        // too close to midnight: let the chip roll over to its 03-01 first,
+        // with the lock released so other callers are not held up meanwhile
+        int64_t remain = us_to_tick(ds1307_handle);
+        unlock(ds1307_handle);
+        vTaskDelay(pdMS_TO_TICKS((remain >= 0 ? remain : 1000000) / 1000) +
+                   2);
+        lock(ds1307_handle);
+        ESP_GOTO_ON_ERROR(read_image(ds1307_handle, image, SEC_REG, last), err,
+                          TAG, "i2c read failed");
+        ESP_GOTO_ON_ERROR(
+            decode_datetime(buf, ds1307_handle->tm_year_start, &tm), err, TAG,
+            "invalid datetime registers");
+        if (tm.tm_mon != 2 || tm.tm_mday != 1 || tm.tm_hour != 0 ||
+            tm.tm_min != 0) {
+            goto err; // someone else moved the clock meanwhile
+        }
+        date = 0x02;
+    }
+    buf[DATE_OFFSET] = date;
+    buf[MON_OFFSET] = 0x03;
+    ESP_GOTO_ON_ERROR(write_image(ds1307_handle, image, SEC_REG + DATE_OFFSET,
+                                  SEC_REG + MON_OFFSET),
+                      err, TAG, "i2c write failed");
+    *fixed = true;
+err:
+    unlock(ds1307_handle);
+    return ret;
+}
+
+static esp_err_t get_timeval(ds1307_handle_t ds1307_handle,
+                             struct timeval *tv, bool *halt)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+    ESP_RETURN_ON_FALSE(tv, ESP_ERR_INVALID_ARG, TAG, "invalid timeval handle");
+
+    struct tm tm;
+    time_cache_t cache;
+    lock(ds1307_handle);
+    esp_err_t ret = get_datetime(ds1307_handle, &tm, halt);
+    cache_read(ds1307_handle, &cache);
+    unlock(ds1307_handle);
+    ESP_RETURN_ON_ERROR(ret, TAG, "get datetime failed");
+    if (cache.valid) { // a running clock, continue from its anchor
+        int64_t elapsed = esp_timer_get_time() - cache.anchor_us;
+        tv->tv_sec = cache.seconds + elapsed / 1000000;
+        tv->tv_usec = elapsed % 1000000;
+    } else {
+        tv->tv_sec = tm_to_seconds(&tm);
+        tv->tv_usec = 0;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ds1307_get_timeval(ds1307_handle_t ds1307_handle, struct timeval *tv)
+{
+    return get_timeval(ds1307_handle, tv, NULL);
+}
+
+esp_err_t ds1307_get_timeval_running(ds1307_handle_t ds1307_handle,
+                                     struct timeval *tv)
+{
+    bool halt;
+    ESP_RETURN_ON_ERROR(get_timeval(ds1307_handle, tv, &halt), TAG,
+                        "get timeval failed");
+    ESP_RETURN_ON_FALSE(!halt, ESP_ERR_INVALID_STATE, TAG, "clock halted");
+    return ESP_OK;
+}
+
+esp_err_t IRAM_ATTR ds1307_get_timeval_isr(ds1307_handle_t ds1307_handle,
+                                           struct timeval *tv)
+{
+    if (!ds1307_handle || !tv) { // no logging, as documented
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    time_cache_t cache;
+    cache_read(ds1307_handle, &cache);
+    int64_t elapsed = esp_timer_get_time() - cache.anchor_us;
+    if (!cache.valid || elapsed < 0 || elapsed > UINT32_MAX) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // 32-bit division only: 64-bit helpers may live in flash
+    uint32_t elapsed_us = (uint32_t)elapsed;
+    tv->tv_sec = cache.seconds + elapsed_us / 1000000;
+    tv->tv_usec = elapsed_us % 1000000;
+    return ESP_OK;
+}
+
+/* Sleep, then spin out the last RTOS tick, until esp_timer reaches at_us */
+static void wait_until(int64_t at_us)
+{
+    int64_t remain = at_us - esp_timer_get_time();
+    if (remain > 2000LL * portTICK_PERIOD_MS) {
+        vTaskDelay(remain / 1000 / portTICK_PERIOD_MS - 1);
+    }
+    while (esp_timer_get_time() < at_us) {
+    }
+}
+
+/*
+ * Write all time registers; start clears CH in the same burst. With at_us,
+ * the write is timed so the seconds byte lands at that esp_timer time, or
+ * at the first whole second after it still ahead once the lock is held.
+ */
+static esp_err_t set_datetime(ds1307_handle_t ds1307_handle,
+                              const struct tm *tm, bool start, int64_t at_us)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+    ESP_RETURN_ON_FALSE(tm, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid datetime handle");
+    ESP_RETURN_ON_FALSE(tm_valid(tm), ESP_ERR_INVALID_ARG, TAG,
+                        "invalid datetime");
+
+    esp_err_t ret = ESP_OK;
+    uint8_t image[IMAGE_SIZE], *buf = image + SEC_REG;
+    struct tm next;
+    int64_t write_us = 0;
+    lock(ds1307_handle);
+    ESP_GOTO_ON_ERROR(read_image(ds1307_handle, image, SEC_REG,
+                                 SEC_REG + HOUR_OFFSET),
+                      err, TAG, "i2c read failed");
+    if (at_us) { // the chip restarts its second when the seconds byte is in
+        write_us = at_us - (int64_t)SEC_ACK_BITS * 1000000 /
+                               ds1307_handle->scl_speed_hz;
+        int64_t late = esp_timer_get_time() - write_us;
+        if (late >= 0) { // the lock or the read took the boundary
+            int64_t skip = late / 1000000 + 1;
+            seconds_to_tm(tm_to_seconds(tm) + skip, &next);
+            tm = &next;
+            at_us += skip * 1000000;
+            write_us += skip * 1000000;
+        }
+    }
+    uint8_t ch = start ? 0 : buf[SEC_OFFSET] & SEC_CH_BIT;
     uint8_t hour_12 = buf[HOUR_OFFSET] & HOUR_12_BIT;
 
-    buf[0] = reg;
-    buf[SEC_OFFSET + 1] = (int2bcd(tm->tm_sec) & SEC_MASK) | ch;
-    buf[MIN_OFFSET + 1] = int2bcd(tm->tm_min);
+    buf[SEC_OFFSET] = (int2bcd(tm->tm_sec) & SEC_MASK) | ch;
+    buf[MIN_OFFSET] = int2bcd(tm->tm_min);
     if (hour_12) { // 12-Hour
-        buf[HOUR_OFFSET + 1] = to_12_hour(tm->tm_hour);
+        buf[HOUR_OFFSET] = to_12_hour(tm->tm_hour);
     } else { // 24-Hour
-        buf[HOUR_OFFSET + 1] = int2bcd(tm->tm_hour);
+        buf[HOUR_OFFSET] = int2bcd(tm->tm_hour);
     }
-    buf[DAY_OFFSET + 1] = int2bcd(tm->tm_wday + 1);
-    buf[DATE_OFFSET + 1] = int2bcd(tm->tm_mday);
-    buf[MON_OFFSET + 1] = int2bcd(tm->tm_mon + 1);
+    buf[DAY_OFFSET] = int2bcd(tm->tm_wday + 1);
+    buf[DATE_OFFSET] = int2bcd(tm->tm_mday);
+    buf[MON_OFFSET] = int2bcd(tm->tm_mon + 1);
     int year = tm->tm_year % 100;
     if (year < 0) {
         year += 100;
     }
-    buf[YEAR_OFFSET + 1] = int2bcd(year);
-    ESP_RETURN_ON_ERROR(
-        i2c_master_transmit(ds1307_handle->i2c_dev, buf, sizeof(buf), -1), TAG,
-        "i2c write failed");
+    buf[YEAR_OFFSET] = int2bcd(year);
+    cache_invalidate(ds1307_handle);
+    if (at_us) {
+        wait_until(write_us);
+    }
+    int64_t now = at_us ? at_us : esp_timer_get_time();
+    ESP_GOTO_ON_ERROR(write_image(ds1307_handle, image, SEC_REG,
+                                  SEC_REG + YEAR_OFFSET),
+                      err, TAG, "i2c write failed");
+    if (!ch) { // writing seconds restarts the countdown chain
+        cache_store(ds1307_handle, tm, now, true);
+    }
+err:
+    unlock(ds1307_handle);
+    return ret;
+}
 
-    return ESP_OK;
+esp_err_t ds1307_set_datetime(ds1307_handle_t ds1307_handle,
+                              const struct tm *tm)
+{
+    return set_datetime(ds1307_handle, tm, false, 0);
+}
+
+esp_err_t ds1307_start_datetime(ds1307_handle_t ds1307_handle,
+                                const struct tm *tm)
+{
+    return set_datetime(ds1307_handle, tm, true, 0);
+}
+
+esp_err_t ds1307_set_timeval(ds1307_handle_t ds1307_handle,
+                             const struct timeval *tv)
+{
+    ESP_RETURN_ON_FALSE(tv, ESP_ERR_INVALID_ARG, TAG, "invalid timeval handle");
+
+    struct tm tm;
+    seconds_to_tm(tv->tv_sec, &tm);
+    return ds1307_set_datetime(ds1307_handle, &tm);
+}
+
+esp_err_t ds1307_set_timeval_aligned(ds1307_handle_t ds1307_handle,
+                                     const struct timeval *tv)
+{
+    ESP_RETURN_ON_FALSE(tv, ESP_ERR_INVALID_ARG, TAG, "invalid timeval handle");
+    ESP_RETURN_ON_FALSE(tv->tv_usec >= 0 && tv->tv_usec < 1000000,
+                        ESP_ERR_INVALID_ARG, TAG, "invalid timeval");
+
+    int64_t now = esp_timer_get_time();
+    int64_t sec = tv->tv_sec + 1, remain = 1000000 - tv->tv_usec;
+    if (remain < ALIGN_MIN_US) { // no time left to read and lock first
+        sec++;
+        remain += 1000000;
+    }
+    struct tm tm;
+    seconds_to_tm(sec, &tm);
+    return set_datetime(ds1307_handle, &tm, false, now + remain);
 }
 
 esp_err_t ds1307_get_data(ds1307_handle_t ds1307_handle, ds1307_data_t *data)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
                         "invalid ds1307 handle");
-    ESP_RETURN_ON_FALSE(data, ESP_ERR_NO_MEM, TAG, "invalid data handle");
+    ESP_RETURN_ON_FALSE(data, ESP_ERR_INVALID_ARG, TAG, "invalid data handle");
 
+    esp_err_t ret = ESP_OK;
     uint8_t reg = SEC_REG, buf[BUF_SIZE];
-    ESP_RETURN_ON_ERROR(i2c_master_transmit_receive(ds1307_handle->i2c_dev,
-                                                    &reg, sizeof(reg), buf,
-                                                    sizeof(buf), -1),
-                        TAG, "i2c read failed");
+    lock(ds1307_handle);
+    ESP_GOTO_ON_ERROR(read_regs(ds1307_handle, reg, buf, sizeof(buf)), err,
+                      TAG, "i2c read failed");
     memset(data, 0, sizeof(ds1307_data_t));
     data->second = buf[SEC_OFFSET] & SEC_MASK;
     data->minute = buf[MIN_OFFSET];
@@ -228,116 +1046,185 @@ esp_err_t ds1307_get_data(ds1307_handle_t ds1307_handle, ds1307_data_t *data)
     data->date = buf[DATE_OFFSET];
     data->month = buf[MON_OFFSET];
     data->year = buf[YEAR_OFFSET];
+err:
+    unlock(ds1307_handle);
+    return ret;
+}
+
+esp_err_t ds1307_get_registers(ds1307_handle_t ds1307_handle, uint8_t *regs)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+    ESP_RETURN_ON_FALSE(regs, ESP_ERR_INVALID_ARG, TAG, "invalid regs handle");
+
+    esp_err_t ret = ESP_OK;
+    lock(ds1307_handle);
+    ESP_GOTO_ON_ERROR(
+        read_regs(ds1307_handle, SEC_REG, regs, DS1307_REG_IMAGE_SIZE), err,
+        TAG, "i2c read failed");
+    if (ds1307_handle->multi_master) {
+        gen_update(ds1307_handle, regs[GEN_REG]);
+    }
+    for (int i = 0; i < DS1307_RAM_SIZE; i++) { // staged bytes stay staged
+        if (!(ds1307_handle->ram_dirty & RAM_BIT(i))) {
+            ds1307_handle->ram[i] = regs[RAM_REG + i];
+        }
+    }
+    ds1307_handle->ram_known = RAM_BIT(DS1307_RAM_SIZE) - 1;
+err:
+    unlock(ds1307_handle);
+    return ret;
+}
+
+esp_err_t ds1307_decode_status(const uint8_t *regs, ds1307_status_t *status)
+{
+    ESP_RETURN_ON_FALSE(regs, ESP_ERR_INVALID_ARG, TAG, "invalid regs handle");
+    ESP_RETURN_ON_FALSE(status, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid status handle");
+
+    status->halt = regs[SEC_REG + SEC_OFFSET] & SEC_CH_BIT;
+    status->hour_12 = regs[SEC_REG + HOUR_OFFSET] & HOUR_12_BIT;
+    status->output = regs[CTRL_REG] & CTRL_OUT_BIT;
+    status->square_wave_enable = regs[CTRL_REG] & CTRL_SQWE_BIT;
+    status->rate_select = regs[CTRL_REG] & CTRL_RS_MASK;
     return ESP_OK;
 }
 
 esp_err_t ds1307_set_data(ds1307_handle_t ds1307_handle,
                           const ds1307_data_t *data)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
                         "invalid ds1307 handle");
-    ESP_RETURN_ON_FALSE(data, ESP_ERR_NO_MEM, TAG, "invalid data handle");
+    ESP_RETURN_ON_FALSE(data, ESP_ERR_INVALID_ARG, TAG, "invalid data handle");
 
-    uint8_t reg = SEC_REG, buf[BUF_SIZE + 1];
-    ESP_RETURN_ON_ERROR(i2c_master_transmit_receive(ds1307_handle->i2c_dev,
-                                                    &reg, sizeof(reg), buf, 1,
-                                                    -1),
-                        TAG, "i2c read failed");
+    esp_err_t ret = ESP_OK;
+    uint8_t image[IMAGE_SIZE], *buf = image + SEC_REG;
+    lock(ds1307_handle);
+    ESP_GOTO_ON_ERROR(read_image(ds1307_handle, image, SEC_REG, SEC_REG), err,
+                      TAG, "i2c read failed");
     uint8_t ch = buf[SEC_OFFSET] & SEC_CH_BIT;
 
-    buf[0] = reg;
-    buf[SEC_OFFSET + 1] = (data->second & SEC_MASK) | ch;
-    buf[MIN_OFFSET + 1] = data->minute & 0x7f;
+    buf[SEC_OFFSET] = (data->second & SEC_MASK) | ch;
+    buf[MIN_OFFSET] = data->minute & 0x7f;
     if (data->hour_12) { // 12-Hour
-        buf[HOUR_OFFSET + 1] = (data->hour & HOUR_12_MASK) | HOUR_12_BIT |
-                               (data->hour_pm ? HOUR_PM_BIT : 0);
+        buf[HOUR_OFFSET] = (data->hour & HOUR_12_MASK) | HOUR_12_BIT |
+                           (data->hour_pm ? HOUR_PM_BIT : 0);
     } else { // 24-Hour
-        buf[HOUR_OFFSET + 1] = data->hour & 0x3f;
+        buf[HOUR_OFFSET] = data->hour & 0x3f;
     }
-    buf[DAY_OFFSET + 1] = data->day & 0x07;
-    buf[DATE_OFFSET + 1] = data->date & 0x3f;
-    buf[MON_OFFSET + 1] = data->month & 0x1f;
-    buf[YEAR_OFFSET + 1] = data->year;
-    ESP_RETURN_ON_ERROR(
-        i2c_master_transmit(ds1307_handle->i2c_dev, buf, sizeof(buf), -1), TAG,
-        "i2c write failed");
+    buf[DAY_OFFSET] = data->day & 0x07;
+    buf[DATE_OFFSET] = data->date & 0x3f;
+    buf[MON_OFFSET] = data->month & 0x1f;
+    buf[YEAR_OFFSET] = data->year;
+    cache_invalidate(ds1307_handle);
+    ESP_GOTO_ON_ERROR(write_image(ds1307_handle, image, SEC_REG,
+                                  SEC_REG + YEAR_OFFSET),
+                      err, TAG, "i2c write failed");
+err:
+    unlock(ds1307_handle);
+    return ret;
+}
+
+/* Read one register under the device lock */
+static esp_err_t get_reg(ds1307_handle_t ds1307_handle, uint8_t reg,
+                         uint8_t *value)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
 
+    lock(ds1307_handle);
+    esp_err_t ret = read_regs(ds1307_handle, reg, value, sizeof(*value));
+    unlock(ds1307_handle);
+    ESP_RETURN_ON_ERROR(ret, TAG, "i2c read failed");
     return ESP_OK;
 }
 
 esp_err_t ds1307_get_12_hour(ds1307_handle_t ds1307_handle, bool *mode)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
-                        "invalid ds1307 handle");
-    ESP_RETURN_ON_FALSE(mode, ESP_ERR_NO_MEM, TAG, "invalid mode handle");
+    ESP_RETURN_ON_FALSE(mode, ESP_ERR_INVALID_ARG, TAG, "invalid mode handle");
 
-    uint8_t reg = SEC_REG + HOUR_OFFSET, value;
-    ESP_RETURN_ON_ERROR(i2c_master_transmit_receive(ds1307_handle->i2c_dev,
-                                                    &reg, sizeof(reg), &value,
-                                                    sizeof(value), -1),
-                        TAG, "i2c read failed");
+    uint8_t value;
+    ESP_RETURN_ON_ERROR(get_reg(ds1307_handle, SEC_REG + HOUR_OFFSET, &value),
+                        TAG, "get hour failed");
     *mode = (value & HOUR_12_BIT) ? true : false;
     return ESP_OK;
 }
 
 esp_err_t ds1307_set_12_hour(ds1307_handle_t ds1307_handle, const bool mode)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
                         "invalid ds1307 handle");
 
-    uint8_t reg = SEC_REG + HOUR_OFFSET, hour;
-    ESP_RETURN_ON_ERROR(i2c_master_transmit_receive(ds1307_handle->i2c_dev,
-                                                    &reg, sizeof(reg), &hour,
-                                                    sizeof(hour), -1),
-                        TAG, "i2c read failed");
+    esp_err_t ret = ESP_OK;
+    uint8_t reg = SEC_REG + HOUR_OFFSET, image[IMAGE_SIZE],
+            *buf = image + SEC_REG;
+    lock(ds1307_handle);
+    ESP_GOTO_ON_ERROR(read_image(ds1307_handle, image, SEC_REG, reg), err, TAG,
+                      "i2c read failed");
+    if (!(buf[SEC_OFFSET] & SEC_CH_BIT) && buf[MIN_OFFSET] == 0x59 &&
+        buf[SEC_OFFSET] == 0x59) { // the hour carries on the next tick
+        ESP_GOTO_ON_ERROR(reread_after_tick(ds1307_handle, image, reg), err,
+                          TAG, "read after tick failed");
+    }
+    uint8_t hour = buf[HOUR_OFFSET];
     if ((hour & HOUR_12_BIT) == (mode ? HOUR_12_BIT : 0)) {
-        return ESP_OK;
+        goto err;
     }
+    ESP_GOTO_ON_FALSE(hour_valid(hour), ESP_ERR_INVALID_RESPONSE, err, TAG,
+                      "invalid hour register");
     if (mode) { // 24-Hour ==> 12-Hour
-        hour = to_12_hour(bcd2int(hour));
+        hour = to_12_hour(bcd2int(hour & HOUR_24_MASK));
     } else { // 12-Hour -=> 24-Hour
         hour = int2bcd(from_12_hour(hour));
     }
-    uint8_t buf[2] = {reg, hour};
-    ESP_RETURN_ON_ERROR(
-        i2c_master_transmit(ds1307_handle->i2c_dev, buf, sizeof(buf), -1), TAG,
-        "i2c write failed");
-    return ESP_OK;
+    image[reg] = hour;
+    ESP_GOTO_ON_ERROR(write_image(ds1307_handle, image, reg, reg), err, TAG,
+                      "i2c write failed");
+err:
+    unlock(ds1307_handle);
+    return ret;
 }
 
 static esp_err_t set_reg(ds1307_handle_t ds1307_handle, uint8_t reg,
                          uint8_t mask, uint8_t value)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
                         "invalid ds1307 handle");
 
-    uint8_t origin;
-    ESP_RETURN_ON_ERROR(i2c_master_transmit_receive(ds1307_handle->i2c_dev,
-                                                    &reg, sizeof(reg), &origin,
-                                                    sizeof(origin), -1),
-                        TAG, "i2c read failed");
+    esp_err_t ret = ESP_OK;
+    uint8_t image[IMAGE_SIZE];
+    lock(ds1307_handle);
+    ESP_GOTO_ON_ERROR(read_image(ds1307_handle, image, reg, reg), err, TAG,
+                      "i2c read failed");
+    if (reg == SEC_REG && !(image[reg] & SEC_CH_BIT) &&
+        us_to_tick(ds1307_handle) < RMW_GUARD_US) {
+        // writing back a stale seconds value would undo the tick
+        ESP_GOTO_ON_ERROR(reread_after_tick(ds1307_handle, image, reg), err,
+                          TAG, "read after tick failed");
+    }
+    uint8_t origin = image[reg];
     if ((origin & (~mask)) == value) {
-        return ESP_OK;
+        goto err;
     }
 
-    uint8_t buf[2] = {reg, (origin & mask) | value};
-    ESP_RETURN_ON_ERROR(
-        i2c_master_transmit(ds1307_handle->i2c_dev, buf, sizeof(buf), -1), TAG,
-        "i2c write failed");
-    return ESP_OK;
+    image[reg] = (origin & mask) | value;
+    if (reg == SEC_REG) {
+        cache_invalidate(ds1307_handle);
+    }
+    ESP_GOTO_ON_ERROR(write_image(ds1307_handle, image, reg, reg), err, TAG,
+                      "i2c write failed");
+err:
+    unlock(ds1307_handle);
+    return ret;
 }
 
 esp_err_t ds1307_get_halt(ds1307_handle_t ds1307_handle, bool *halt)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
-                        "invalid ds1307 handle");
-    ESP_RETURN_ON_FALSE(halt, ESP_ERR_NO_MEM, TAG, "invalid halt handle");
+    ESP_RETURN_ON_FALSE(halt, ESP_ERR_INVALID_ARG, TAG, "invalid halt handle");
 
-    uint8_t reg = SEC_REG, value;
-    ESP_RETURN_ON_ERROR(i2c_master_transmit_receive(ds1307_handle->i2c_dev,
-                                                    &reg, sizeof(reg), &value,
-                                                    sizeof(value), -1),
-                        TAG, "i2c read failed");
+    uint8_t value;
+    ESP_RETURN_ON_ERROR(get_reg(ds1307_handle, SEC_REG, &value), TAG,
+                        "get seconds failed");
     *halt = (value & SEC_CH_BIT) ? true : false;
     return ESP_OK;
 }
@@ -350,15 +1237,12 @@ esp_err_t ds1307_set_halt(ds1307_handle_t ds1307_handle, const bool halt)
 
 esp_err_t ds1307_get_output(ds1307_handle_t ds1307_handle, bool *output)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
-                        "invalid ds1307 handle");
-    ESP_RETURN_ON_FALSE(output, ESP_ERR_NO_MEM, TAG, "invalid output handle");
+    ESP_RETURN_ON_FALSE(output, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid output handle");
 
-    uint8_t reg = CTRL_REG, value;
-    ESP_RETURN_ON_ERROR(i2c_master_transmit_receive(ds1307_handle->i2c_dev,
-                                                    &reg, sizeof(reg), &value,
-                                                    sizeof(value), -1),
-                        TAG, "i2c read failed");
+    uint8_t value;
+    ESP_RETURN_ON_ERROR(get_reg(ds1307_handle, CTRL_REG, &value), TAG,
+                        "get control failed");
     *output = (value & CTRL_OUT_BIT) ? true : false;
     return ESP_OK;
 }
@@ -372,15 +1256,12 @@ esp_err_t ds1307_set_output(ds1307_handle_t ds1307_handle, const bool output)
 esp_err_t ds1307_get_square_wave_enable(ds1307_handle_t ds1307_handle,
                                         bool *enable)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
-                        "invalid ds1307 handle");
-    ESP_RETURN_ON_FALSE(enable, ESP_ERR_NO_MEM, TAG, "invalid enable handle");
+    ESP_RETURN_ON_FALSE(enable, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid enable handle");
 
-    uint8_t reg = CTRL_REG, value;
-    ESP_RETURN_ON_ERROR(i2c_master_transmit_receive(ds1307_handle->i2c_dev,
-                                                    &reg, sizeof(reg), &value,
-                                                    sizeof(value), -1),
-                        TAG, "i2c read failed");
+    uint8_t value;
+    ESP_RETURN_ON_ERROR(get_reg(ds1307_handle, CTRL_REG, &value), TAG,
+                        "get control failed");
     *enable = (value & CTRL_SQWE_BIT) ? true : false;
     return ESP_OK;
 }
@@ -395,15 +1276,12 @@ esp_err_t ds1307_set_square_wave_enable(ds1307_handle_t ds1307_handle,
 esp_err_t ds1307_get_rate_select(ds1307_handle_t ds1307_handle,
                                  ds1307_rate_select_t *rs)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
-                        "invalid ds1307 handle");
-    ESP_RETURN_ON_FALSE(rs, ESP_ERR_NO_MEM, TAG, "invalid rate_select handle");
+    ESP_RETURN_ON_FALSE(rs, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid rate_select handle");
 
-    uint8_t reg = CTRL_REG, value;
-    ESP_RETURN_ON_ERROR(i2c_master_transmit_receive(ds1307_handle->i2c_dev,
-                                                    &reg, sizeof(reg), &value,
-                                                    sizeof(value), -1),
-                        TAG, "i2c read failed");
+    uint8_t value;
+    ESP_RETURN_ON_ERROR(get_reg(ds1307_handle, CTRL_REG, &value), TAG,
+                        "get control failed");
     *rs = value & CTRL_RS_MASK;
     return ESP_OK;
 }
@@ -414,37 +1292,211 @@ esp_err_t ds1307_set_rate_select(ds1307_handle_t ds1307_handle,
     return set_reg(ds1307_handle, CTRL_REG, ~CTRL_RS_MASK, rs & CTRL_RS_MASK);
 }
 
+/* The generation byte belongs to the driver in multi_master mode */
+static bool ram_range_valid(ds1307_handle_t ds1307_handle, uint8_t offset,
+                            uint8_t size)
+{
+    if (size == 0 || offset + size > DS1307_RAM_SIZE) {
+        return false;
+    }
+    return !ds1307_handle->multi_master ||
+           offset > DS1307_RAM_GEN_OFFSET ||
+           offset + size <= DS1307_RAM_GEN_OFFSET;
+}
+
+esp_err_t ds1307_get_ram_range(ds1307_handle_t ds1307_handle, uint8_t *offset,
+                               uint8_t *size)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+    ESP_RETURN_ON_FALSE(offset && size, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid range handle");
+
+    *offset = ds1307_handle->multi_master ? DS1307_RAM_GEN_OFFSET + 1 : 0;
+    *size = DS1307_RAM_SIZE - *offset;
+    return ESP_OK;
+}
+
 esp_err_t ds1307_get_ram(ds1307_handle_t ds1307_handle, uint8_t offset,
                          uint8_t *data, uint8_t size)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
                         "invalid ds1307 handle");
-    ESP_RETURN_ON_FALSE(data, ESP_ERR_NO_MEM, TAG, "invalid data handle");
-    ESP_RETURN_ON_FALSE(offset + size <= DS1307_RAM_SIZE, ESP_ERR_INVALID_ARG,
-                        TAG, "invalid offset or size");
-
-    offset += RAM_REG;
-    ESP_RETURN_ON_ERROR(i2c_master_transmit_receive(ds1307_handle->i2c_dev,
-                                                    &offset, sizeof(offset),
-                                                    data, size, -1),
-                        TAG, "i2c read failed");
-    return ESP_OK;
+    ESP_RETURN_ON_FALSE(data, ESP_ERR_INVALID_ARG, TAG, "invalid data handle");
+    ESP_RETURN_ON_FALSE(ram_range_valid(ds1307_handle, offset, size),
+                        ESP_ERR_INVALID_ARG, TAG, "invalid offset or size");
+
+    esp_err_t ret = ESP_OK;
+    uint64_t mask = (RAM_BIT(size) - 1) << offset;
+    lock(ds1307_handle);
+    uint64_t shadow = ds1307_handle->ram_dirty;
+    if (ds1307_handle->low_power) {
+        shadow |= ds1307_handle->ram_known;
+    }
+    if ((shadow & mask) == mask && ds1307_handle->multi_master &&
+        (ds1307_handle->ram_dirty & mask) != mask) {
+        // known bytes are only as good as the generation they were read in
+        ESP_GOTO_ON_ERROR(gen_check(ds1307_handle), err, TAG,
+                          "i2c read failed");
+        shadow = ds1307_handle->ram_dirty | ds1307_handle->ram_known;
+    }
+    if ((shadow & mask) != mask) {
+        ESP_GOTO_ON_ERROR(
+            read_regs(ds1307_handle, offset + RAM_REG, data, size), err, TAG,
+            "i2c read failed");
+    } else {
+        memcpy(data, ds1307_handle->ram + offset, size);
+    }
+    for (int i = 0; i < size; i++) { // staged bytes win over the chip
+        if (ds1307_handle->ram_dirty & RAM_BIT(offset + i)) {
+            data[i] = ds1307_handle->ram[offset + i];
+        } else {
+            ds1307_handle->ram[offset + i] = data[i];
+        }
+    }
+    ds1307_handle->ram_known |= mask;
+err:
+    unlock(ds1307_handle);
+    return ret;
 }
 
 esp_err_t ds1307_set_ram(ds1307_handle_t ds1307_handle, uint8_t offset,
                          const uint8_t *data, uint8_t size)
 {
-    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_NO_MEM, TAG,
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
                         "invalid ds1307 handle");
-    ESP_RETURN_ON_FALSE(data, ESP_ERR_NO_MEM, TAG, "invalid data handle");
-    ESP_RETURN_ON_FALSE(offset + size <= DS1307_RAM_SIZE, ESP_ERR_INVALID_ARG,
-                        TAG, "invalid offset or size");
+    ESP_RETURN_ON_FALSE(data, ESP_ERR_INVALID_ARG, TAG, "invalid data handle");
+    ESP_RETURN_ON_FALSE(ram_range_valid(ds1307_handle, offset, size),
+                        ESP_ERR_INVALID_ARG, TAG, "invalid offset or size");
 
-    uint8_t buf[DS1307_RAM_SIZE + 1];
-    buf[0] = offset + RAM_REG;
-    memcpy(buf + 1, data, size);
-    ESP_RETURN_ON_ERROR(
-        i2c_master_transmit(ds1307_handle->i2c_dev, buf, size + 1, -1), TAG,
-        "i2c write failed");
+    esp_err_t ret = ESP_OK;
+    uint64_t mask = (RAM_BIT(size) - 1) << offset;
+    lock(ds1307_handle);
+    memcpy(ds1307_handle->ram + offset, data, size);
+    if (ds1307_handle->low_power && ds1307_handle->lp.ram_write_back) {
+        ds1307_handle->ram_dirty |= mask; // written by ds1307_flush_ram
+        goto err;
+    }
+    ds1307_handle->ram_known &= ~mask;
+    ESP_GOTO_ON_ERROR(write_ram(ds1307_handle, offset, offset + size), err,
+                      TAG, "i2c write failed");
+    ds1307_handle->ram_known |= mask;
+    ds1307_handle->ram_dirty &= ~mask;
+err:
+    unlock(ds1307_handle);
+    return ret;
+}
+
+esp_err_t ds1307_flush_ram(ds1307_handle_t ds1307_handle)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+
+    lock(ds1307_handle);
+    esp_err_t ret = flush_ram(ds1307_handle);
+    unlock(ds1307_handle);
+    return ret;
+}
+
+esp_err_t ds1307_set_low_power(ds1307_handle_t ds1307_handle,
+                               const ds1307_low_power_config_t *config)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+
+    esp_err_t ret = ESP_OK;
+    lock(ds1307_handle);
+    if (config == NULL) {
+        ESP_GOTO_ON_ERROR(flush_ram(ds1307_handle), err, TAG,
+                          "flush ram failed");
+        ds1307_handle->low_power = false;
+        goto err;
+    }
+    ds1307_handle->lp = *config;
+    ds1307_handle->low_power = true;
+    ds1307_handle->budget_start_us = esp_timer_get_time();
+    ds1307_handle->budget_used = 0;
+    if (config->transaction_charge_nc) {
+        ds1307_handle->transaction_charge_nc = config->transaction_charge_nc;
+    }
+    if (config->byte_charge_nc) {
+        ds1307_handle->byte_charge_nc = config->byte_charge_nc;
+    }
+    if (!config->ram_write_back) {
+        ESP_GOTO_ON_ERROR(flush_ram(ds1307_handle), err, TAG,
+                          "flush ram failed");
+    }
+err:
+    unlock(ds1307_handle);
+    ESP_RETURN_ON_ERROR(ret, TAG, "set low power failed");
+    if (config && config->sqw_wakeup) {
+        return set_reg(ds1307_handle, CTRL_REG,
+                       (uint8_t)~(CTRL_SQWE_BIT | CTRL_RS_MASK),
+                       CTRL_SQWE_BIT | DS1307_RATE_SELECT_1HZ);
+    }
+    return ESP_OK;
+}
+
+esp_err_t IRAM_ATTR ds1307_sqw_edge(ds1307_handle_t ds1307_handle)
+{
+    if (!ds1307_handle) { // no logging from the GPIO ISR
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_OK;
+    time_cache_t *cache = &ds1307_handle->cache;
+    int64_t now = esp_timer_get_time();
+    cache_write_begin(ds1307_handle);
+    int64_t elapsed = now - cache->anchor_us;
+    // room for the rounding below in 32 bits
+    if (!cache->valid || elapsed < 0 || elapsed > UINT32_MAX - 1000000) {
+        ret = ESP_ERR_INVALID_STATE; // refresh with a chip read first
+    } else {
+        // An unaligned anchor sits inside a second: count boundaries passed
+        cache->seconds +=
+            ((uint32_t)elapsed + (cache->aligned ? 500000 : 999999)) / 1000000;
+        cache->anchor_us = now;
+        cache->aligned = true;
+    }
+    cache_write_end(ds1307_handle);
+    return ret;
+}
+
+esp_err_t ds1307_get_charge(ds1307_handle_t ds1307_handle,
+                            uint64_t *charge_nc)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+    ESP_RETURN_ON_FALSE(charge_nc, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid charge handle");
+
+    lock(ds1307_handle);
+    *charge_nc = ds1307_handle->charge_nc;
+    unlock(ds1307_handle);
+    return ESP_OK;
+}
+
+esp_err_t ds1307_get_stats(ds1307_handle_t ds1307_handle,
+                           ds1307_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+    ESP_RETURN_ON_FALSE(stats, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid stats handle");
+
+    lock(ds1307_handle);
+    *stats = ds1307_handle->stats;
+    unlock(ds1307_handle);
+    return ESP_OK;
+}
+
+esp_err_t ds1307_reset_stats(ds1307_handle_t ds1307_handle)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+
+    lock(ds1307_handle);
+    memset(&ds1307_handle->stats, 0, sizeof(ds1307_stats_t));
+    unlock(ds1307_handle);
     return ESP_OK;
 }
@@ -0,0 +1,287 @@
+#include "ds1307_checkpoint.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/***
+ * Slot | 0  1 | 2  3  4  5  6         | 7
+ *      | seq  | seconds since epoch   | CRC-8 of bytes 0-6
+ * little endian, seq counts writes and picks the latest slot
+ ***/
+
+#define DEFAULT_SLOT_COUNT 16
+#define SEQ_OFFSET 0
+#define SECONDS_OFFSET 2
+#define SECONDS_SIZE 5
+#define CRC_OFFSET 7
+#define CRC_POLY 0x07
+#define CRC_INIT 0xff // blank (0x00 or 0xff) slots never pass
+#define EEPROM_WRITE_US 10000 // AT24C32 self-timed write cycle
+#define TASK_STACK_SIZE 3072
+#define TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#define PERIOD_MAX_S ((portMAX_DELAY - 1) / configTICK_RATE_HZ)
+
+static const char TAG[] = "ds1307_checkpoint";
+
+struct ds1307_checkpoint_t {
+    ds1307_handle_t ds1307_handle;
+    i2c_master_dev_handle_t i2c_dev; /*!< EEPROM device handle */
+    uint16_t eeprom_offset;
+    uint8_t slot_count;
+    uint8_t next_slot;               /*!< Slot the next save goes to */
+    uint16_t next_seq;               /*!< Sequence number of the next save */
+    int64_t write_us;                /*!< End of the last EEPROM write */
+    bool restored;                   /*!< Halted clock seeded at startup */
+    SemaphoreHandle_t lock;          /*!< Serializes saves */
+    uint32_t period_s;               /*!< Periodic save interval */
+    TaskHandle_t task;               /*!< Periodic saves, NULL for manual */
+    SemaphoreHandle_t task_done;     /*!< Given by the task as it exits */
+};
+
+static uint8_t crc8(const uint8_t *data, size_t size)
+{
+    uint8_t crc = CRC_INIT;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ CRC_POLY : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static bool slot_decode(const uint8_t *slot, uint16_t *seq, int64_t *seconds)
+{
+    if (crc8(slot, CRC_OFFSET) != slot[CRC_OFFSET]) {
+        return false;
+    }
+    *seq = slot[SEQ_OFFSET] | slot[SEQ_OFFSET + 1] << 8;
+    uint64_t value = 0;
+    for (int i = SECONDS_SIZE - 1; i >= 0; i--) {
+        value = value << 8 | slot[SECONDS_OFFSET + i];
+    }
+    // sign-extend the 40-bit value
+    *seconds = (int64_t)(value << 24) >> 24;
+    return true;
+}
+
+static void slot_encode(uint8_t *slot, uint16_t seq, int64_t seconds)
+{
+    slot[SEQ_OFFSET] = seq & 0xff;
+    slot[SEQ_OFFSET + 1] = seq >> 8;
+    for (int i = 0; i < SECONDS_SIZE; i++) {
+        slot[SECONDS_OFFSET + i] = (uint64_t)seconds >> (8 * i) & 0xff;
+    }
+    slot[CRC_OFFSET] = crc8(slot, CRC_OFFSET);
+}
+
+/* Find the latest valid slot and where the next save goes */
+static esp_err_t scan(ds1307_checkpoint_handle_t checkpoint, bool *found,
+                      int64_t *seconds)
+{
+    size_t size = checkpoint->slot_count * DS1307_CHECKPOINT_SLOT_SIZE;
+    uint8_t *slots = malloc(size);
+    ESP_RETURN_ON_FALSE(slots, ESP_ERR_NO_MEM, TAG,
+                        "no memory for checkpoint slots");
+    uint8_t addr[2] = {checkpoint->eeprom_offset >> 8,
+                       checkpoint->eeprom_offset & 0xff};
+    esp_err_t ret = i2c_master_transmit_receive(
+        checkpoint->i2c_dev, addr, sizeof(addr), slots, size, -1);
+    uint16_t latest = 0;
+    *found = false;
+    for (int i = 0; ret == ESP_OK && i < checkpoint->slot_count; i++) {
+        uint16_t seq;
+        int64_t value;
+        if (!slot_decode(slots + i * DS1307_CHECKPOINT_SLOT_SIZE, &seq,
+                         &value)) {
+            continue;
+        }
+        // sequence numbers compare modulo 2^16
+        if (!*found || (int16_t)(seq - latest) > 0) {
+            *found = true;
+            *seconds = value;
+            latest = seq;
+            checkpoint->next_seq = seq + 1;
+            checkpoint->next_slot = (i + 1) % checkpoint->slot_count;
+        }
+    }
+    free(slots);
+    return ret;
+}
+
+/* Start a halted clock at the checkpoint plus the time since boot */
+static esp_err_t restore(ds1307_checkpoint_handle_t checkpoint,
+                         int64_t seconds)
+{
+    time_t now = seconds + (esp_timer_get_time() + 500000) / 1000000;
+    struct tm tm;
+    ESP_RETURN_ON_FALSE(gmtime_r(&now, &tm), ESP_ERR_INVALID_RESPONSE, TAG,
+                        "invalid checkpoint");
+    ESP_RETURN_ON_ERROR(ds1307_start_datetime(checkpoint->ds1307_handle, &tm),
+                        TAG, "start datetime failed");
+    checkpoint->restored = true;
+    ESP_LOGW(TAG, "clock was halted, restored from checkpoint");
+    return ESP_OK;
+}
+
+/*
+ * Periodic saves block on the bus and the EEPROM write cycle, so they run
+ * in their own task rather than in the esp_timer task. A notification from
+ * ds1307_checkpoint_del ends it.
+ */
+static void save_task(void *arg)
+{
+    ds1307_checkpoint_handle_t checkpoint = arg;
+    TickType_t period = (TickType_t)checkpoint->period_s * configTICK_RATE_HZ;
+    while (!ulTaskNotifyTake(pdTRUE, period)) {
+        esp_err_t ret = ds1307_checkpoint_save(checkpoint);
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "periodic save failed: %s", esp_err_to_name(ret));
+        }
+    }
+    xSemaphoreGive(checkpoint->task_done); // checkpoint is freed after this
+    vTaskDelete(NULL);
+}
+
+esp_err_t ds1307_checkpoint_new(i2c_master_bus_handle_t bus_handle,
+                                ds1307_handle_t ds1307_handle,
+                                const ds1307_checkpoint_config_t *config,
+                                ds1307_checkpoint_handle_t *checkpoint)
+{
+    ESP_RETURN_ON_FALSE(bus_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid i2c master bus");
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+    ESP_RETURN_ON_FALSE(config && checkpoint, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid args");
+    uint8_t slot_count =
+        config->slot_count ? config->slot_count : DEFAULT_SLOT_COUNT;
+    // slots are slot size aligned, so none straddles a 32-byte page
+    ESP_RETURN_ON_FALSE(
+        config->eeprom_offset % DS1307_CHECKPOINT_SLOT_SIZE == 0 &&
+            slot_count <= DS1307_CHECKPOINT_SLOTS_MAX &&
+            config->eeprom_offset + slot_count * DS1307_CHECKPOINT_SLOT_SIZE <=
+                DS1307_EEPROM_SIZE,
+        ESP_ERR_INVALID_ARG, TAG, "invalid offset or slot count");
+    ESP_RETURN_ON_FALSE(config->period_s <= PERIOD_MAX_S, ESP_ERR_INVALID_ARG,
+                        TAG, "period too long");
+
+    esp_err_t ret = ESP_OK;
+    ds1307_checkpoint_handle_t out =
+        calloc(1, sizeof(struct ds1307_checkpoint_t));
+    ESP_GOTO_ON_FALSE(out, ESP_ERR_NO_MEM, err, TAG,
+                      "no memory for checkpoint");
+    out->ds1307_handle = ds1307_handle;
+    out->eeprom_offset = config->eeprom_offset;
+    out->slot_count = slot_count;
+    out->lock = xSemaphoreCreateMutex();
+    ESP_GOTO_ON_FALSE(out->lock, ESP_ERR_NO_MEM, err, TAG,
+                      "no memory for checkpoint lock");
+    ESP_GOTO_ON_ERROR(i2c_master_bus_add_device(
+                          bus_handle, &config->eeprom_device, &out->i2c_dev),
+                      err, TAG, "i2c new bus failed");
+
+    bool found, halt;
+    int64_t seconds = 0;
+    ESP_GOTO_ON_ERROR(scan(out, &found, &seconds), err, TAG,
+                      "read checkpoint failed");
+    ESP_GOTO_ON_ERROR(ds1307_get_halt(ds1307_handle, &halt), err, TAG,
+                      "get halt failed");
+    if (halt && found) {
+        ESP_GOTO_ON_ERROR(restore(out, seconds), err, TAG, "restore failed");
+    }
+
+    if (config->period_s) {
+        out->period_s = config->period_s;
+        out->task_done = xSemaphoreCreateBinary();
+        ESP_GOTO_ON_FALSE(out->task_done, ESP_ERR_NO_MEM, err, TAG,
+                          "no memory for checkpoint task");
+        ESP_GOTO_ON_FALSE(xTaskCreate(save_task, "ds1307_checkpoint",
+                                      TASK_STACK_SIZE, out, TASK_PRIORITY,
+                                      &out->task) == pdPASS,
+                          ESP_ERR_NO_MEM, err, TAG,
+                          "no memory for checkpoint task");
+    }
+    *checkpoint = out;
+    return ESP_OK;
+
+err:
+    if (out && out->task_done) {
+        vSemaphoreDelete(out->task_done);
+    }
+    if (out && out->i2c_dev) {
+        i2c_master_bus_rm_device(out->i2c_dev);
+    }
+    if (out && out->lock) {
+        vSemaphoreDelete(out->lock);
+    }
+    free(out);
+    return ret;
+}
+
+esp_err_t ds1307_checkpoint_del(ds1307_checkpoint_handle_t checkpoint)
+{
+    ESP_RETURN_ON_FALSE(checkpoint, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid checkpoint");
+
+    if (checkpoint->task) { // let a save in progress finish, then the task
+        xTaskNotifyGive(checkpoint->task);
+        xSemaphoreTake(checkpoint->task_done, portMAX_DELAY);
+        vSemaphoreDelete(checkpoint->task_done);
+        checkpoint->task = NULL;
+    }
+    ESP_RETURN_ON_ERROR(i2c_master_bus_rm_device(checkpoint->i2c_dev), TAG,
+                        "rm i2c device failed");
+    vSemaphoreDelete(checkpoint->lock);
+    free(checkpoint);
+    return ESP_OK;
+}
+
+esp_err_t ds1307_checkpoint_save(ds1307_checkpoint_handle_t checkpoint)
+{
+    ESP_RETURN_ON_FALSE(checkpoint, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid checkpoint");
+
+    // a halted clock would overwrite the last good time with a stale one
+    struct timeval tv;
+    ESP_RETURN_ON_ERROR(
+        ds1307_get_timeval_running(checkpoint->ds1307_handle, &tv), TAG,
+        "get running time failed");
+
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(checkpoint->lock, portMAX_DELAY);
+    int64_t wait = checkpoint->write_us - esp_timer_get_time();
+    if (wait > 0) { // the previous write cycle is still running
+        vTaskDelay(pdMS_TO_TICKS(wait / 1000 + 1));
+    }
+    uint16_t addr = checkpoint->eeprom_offset +
+                    checkpoint->next_slot * DS1307_CHECKPOINT_SLOT_SIZE;
+    uint8_t buf[2 + DS1307_CHECKPOINT_SLOT_SIZE] = {addr >> 8, addr & 0xff};
+    slot_encode(buf + 2, checkpoint->next_seq, tv.tv_sec);
+    ESP_GOTO_ON_ERROR(
+        i2c_master_transmit(checkpoint->i2c_dev, buf, sizeof(buf), -1), err,
+        TAG, "i2c write failed");
+    checkpoint->write_us = esp_timer_get_time() + EEPROM_WRITE_US;
+    checkpoint->next_seq++;
+    checkpoint->next_slot =
+        (checkpoint->next_slot + 1) % checkpoint->slot_count;
+err:
+    xSemaphoreGive(checkpoint->lock);
+    return ret;
+}
+
+esp_err_t ds1307_checkpoint_restored(ds1307_checkpoint_handle_t checkpoint,
+                                     bool *restored)
+{
+    ESP_RETURN_ON_FALSE(checkpoint && restored, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid args");
+
+    *restored = checkpoint->restored;
+    return ESP_OK;
+}
@@ -0,0 +1,300 @@
+#include "ds1307_console.h"
+#include "esp_check.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS 100
+
+static const char TAG[] = "ds1307_console";
+
+static ds1307_handle_t s_ds1307_handle;
+
+static int report(esp_err_t ret)
+{
+    if (ret != ESP_OK) {
+        printf("error: %s\n", esp_err_to_name(ret));
+        return 1;
+    }
+    return 0;
+}
+
+/* A whole argument as a number no greater than max */
+static bool parse(const char *arg, int base, unsigned long max,
+                  unsigned long *value)
+{
+    char *end;
+    *value = strtoul(arg, &end, base);
+    return end != arg && *end == '\0' && arg[0] != '-' && *value <= max;
+}
+
+/* 0 = Sunday, for years after 0 AD */
+static int weekday(int year, int mon, int mday)
+{
+    static const int t[] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+    year -= mon < 3;
+    return (year + year / 4 - year / 100 + year / 400 + t[mon - 1] + mday) %
+           7;
+}
+
+static int rtc_set(int argc, char **argv)
+{
+    if (argc == 2) { // from the system clock, ticking in step with it
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return report(ds1307_set_timeval_aligned(s_ds1307_handle, &tv));
+    }
+    struct tm tm = {0};
+    int year, mon;
+    if (argc != 4 ||
+        sscanf(argv[2], "%d-%d-%d", &year, &mon, &tm.tm_mday) != 3 ||
+        sscanf(argv[3], "%d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec) !=
+            3 ||
+        year < 1 || mon < 1 || mon > 12) {
+        printf("usage: rtc set [YYYY-MM-DD HH:MM:SS]\n");
+        return 1;
+    }
+    tm.tm_year = year - 1900;
+    tm.tm_mon = mon - 1;
+    tm.tm_wday = weekday(year, mon, tm.tm_mday);
+    return report(ds1307_set_datetime(s_ds1307_handle, &tm));
+}
+
+static int rtc_get(void)
+{
+    struct tm tm;
+    esp_err_t ret = ds1307_get_datetime(s_ds1307_handle, &tm);
+    if (ret == ESP_OK) {
+        char buf[32];
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+        printf("%s weekday %d\n", buf, tm.tm_wday);
+    }
+    return report(ret);
+}
+
+/* One register image read instead of a getter per flag */
+static int rtc_status(void)
+{
+    uint8_t regs[DS1307_REG_IMAGE_SIZE];
+    ds1307_status_t status;
+    esp_err_t ret = ds1307_get_registers(s_ds1307_handle, regs);
+    if (ret == ESP_OK) {
+        ret = ds1307_decode_status(regs, &status);
+    }
+    if (ret == ESP_OK) {
+        static const char *const rates[] = {"1Hz", "4.096kHz", "8.192kHz",
+                                            "32.768kHz"};
+        printf("clock: %s\n", status.halt ? "halted" : "running");
+        printf("hour mode: %s\n", status.hour_12 ? "12-hour" : "24-hour");
+        if (status.square_wave_enable) {
+            printf("SQW/OUT: square wave %s\n", rates[status.rate_select]);
+        } else {
+            printf("SQW/OUT: static %s\n", status.output ? "high" : "low");
+        }
+    }
+    return report(ret);
+}
+
+static int cmd_rtc(int argc, char **argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "get") == 0) {
+        return rtc_get();
+    } else if (argc >= 2 && strcmp(argv[1], "status") == 0) {
+        return rtc_status();
+    } else if (argc >= 2 && strcmp(argv[1], "set") == 0) {
+        return rtc_set(argc, argv);
+    }
+    printf("usage: rtc get|status|set [YYYY-MM-DD HH:MM:SS]\n");
+    return 1;
+}
+
+static void dump(uint8_t base, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (i % 16 == 0) {
+            printf("%s0x%02x:", i ? "\n" : "", (unsigned)(base + i));
+        }
+        printf(" %02x", data[i]);
+    }
+    printf("\n");
+}
+
+/* The whole RAM, less the generation byte if multi_master reserves it */
+static esp_err_t get_all_ram(uint8_t *data, uint8_t *offset, uint8_t *size)
+{
+    esp_err_t ret = ds1307_get_ram_range(s_ds1307_handle, offset, size);
+    if (ret == ESP_OK) {
+        ret = ds1307_get_ram(s_ds1307_handle, *offset, data, *size);
+    }
+    return ret;
+}
+
+static int cmd_ram(int argc, char **argv)
+{
+    uint8_t data[DS1307_RAM_SIZE], offset, size;
+    unsigned long value, count = DS1307_RAM_SIZE;
+    if (argc >= 2 && argc <= 4 && strcmp(argv[1], "dump") == 0) {
+        esp_err_t ret;
+        if (argc == 2) {
+            ret = get_all_ram(data, &offset, &size);
+        } else if (parse(argv[2], 0, DS1307_RAM_SIZE, &value) &&
+                   (argc == 3 || parse(argv[3], 0, DS1307_RAM_SIZE, &count))) {
+            offset = value;
+            size = argc == 3 ? count - offset : count;
+            ret = ds1307_get_ram(s_ds1307_handle, offset, data, size);
+        } else {
+            ret = ESP_ERR_INVALID_ARG;
+        }
+        if (ret == ESP_OK) {
+            dump(offset, data, size);
+        }
+        return report(ret);
+    } else if (argc >= 4 && argc - 3 <= DS1307_RAM_SIZE &&
+               strcmp(argv[1], "write") == 0 &&
+               parse(argv[2], 0, DS1307_RAM_SIZE, &value)) {
+        offset = value;
+        size = argc - 3;
+        for (int i = 0; i < size; i++) {
+            if (!parse(argv[3 + i], 16, 0xff, &value)) {
+                printf("invalid byte: %s\n", argv[3 + i]);
+                return 1;
+            }
+            data[i] = value;
+        }
+        return report(ds1307_set_ram(s_ds1307_handle, offset, data, size));
+    }
+    printf("usage: ram dump [offset [size]] | ram write <offset> <hex>...\n");
+    return 1;
+}
+
+static int cmd_regs(int argc, char **argv)
+{
+    uint8_t regs[DS1307_REG_IMAGE_SIZE];
+    esp_err_t ret = ds1307_get_registers(s_ds1307_handle, regs);
+    if (ret == ESP_OK) {
+        dump(0, regs, sizeof(regs));
+    }
+    return report(ret);
+}
+
+static int cmd_stats(int argc, char **argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "reset") == 0) {
+        return report(ds1307_reset_stats(s_ds1307_handle));
+    }
+    ds1307_stats_t stats;
+    uint64_t charge_nc;
+    ESP_ERROR_CHECK_WITHOUT_ABORT(ds1307_get_charge(s_ds1307_handle,
+                                                    &charge_nc));
+    esp_err_t ret = ds1307_get_stats(s_ds1307_handle, &stats);
+    if (ret == ESP_OK) {
+        printf("reads: %" PRIu32 " (%" PRIu32 " bytes)\n", stats.read_count,
+               stats.read_bytes);
+        printf("writes: %" PRIu32 " (%" PRIu32 " bytes)\n", stats.write_count,
+               stats.write_bytes);
+        printf("errors: %" PRIu32 "\n", stats.error_count);
+        printf("lock waits: %" PRIu32 " (%" PRIu64 " us)\n",
+               stats.lock_wait_count, stats.lock_wait_us);
+        printf("budget denied: %" PRIu32 "\n", stats.budget_denied_count);
+        printf("charge: %" PRIu64 " nC\n", charge_nc);
+    }
+    return report(ret);
+}
+
+static int cmd_bench(int argc, char **argv)
+{
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    if (argc > 2 || (argc == 2 && !parse(argv[1], 0, INT_MAX, &iterations)) ||
+        iterations == 0) {
+        printf("usage: rtc_bench [iterations]\n");
+        return 1;
+    }
+    ds1307_stats_t before, after;
+    struct tm tm;
+    esp_err_t ret = ds1307_get_stats(s_ds1307_handle, &before);
+    int64_t start = esp_timer_get_time();
+    for (unsigned long i = 0; i < iterations && ret == ESP_OK; i++) {
+        ret = ds1307_get_datetime(s_ds1307_handle, &tm);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    if (ret == ESP_OK) {
+        ret = ds1307_get_stats(s_ds1307_handle, &after);
+    }
+    if (report(ret)) {
+        return 1;
+    }
+    printf("ds1307_get_datetime: %.1f us/call, %.2f transactions/call\n",
+           (float)elapsed / iterations,
+           (float)(after.read_count - before.read_count) / iterations);
+
+    uint8_t data[DS1307_RAM_SIZE], offset, size;
+    before = after;
+    start = esp_timer_get_time();
+    for (unsigned long i = 0; i < iterations && ret == ESP_OK; i++) {
+        ret = get_all_ram(data, &offset, &size);
+    }
+    elapsed = esp_timer_get_time() - start;
+    if (ret == ESP_OK) {
+        ret = ds1307_get_stats(s_ds1307_handle, &after);
+    }
+    if (report(ret)) {
+        return 1;
+    }
+    printf("ds1307_get_ram(%u bytes): %.1f us/call, %.0f bytes/s, "
+           "%.2f transactions/call\n",
+           size, (float)elapsed / iterations,
+           (float)size * iterations * 1000000 / elapsed,
+           (float)(after.read_count - before.read_count) / iterations);
+    return 0;
+}
+
+esp_err_t ds1307_console_register(ds1307_handle_t ds1307_handle)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+
+    s_ds1307_handle = ds1307_handle;
+    const esp_console_cmd_t cmds[] = {
+        {
+            .command = "rtc",
+            .help = "Read, inspect or set the DS1307 clock; set without a "
+                    "time copies the system clock, phase aligned",
+            .hint = "get|status|set [YYYY-MM-DD HH:MM:SS]",
+            .func = cmd_rtc,
+        },
+        {
+            .command = "ram",
+            .help = "Dump or write DS1307 RAM, offsets from 0",
+            .hint = "dump [offset [size]] | write <offset> <hex>...",
+            .func = cmd_ram,
+        },
+        {
+            .command = "regs",
+            .help = "Dump all 64 DS1307 registers in one read",
+            .func = cmd_regs,
+        },
+        {
+            .command = "rtc_stats",
+            .help = "Show or reset DS1307 bus statistics",
+            .hint = "[reset]",
+            .func = cmd_stats,
+        },
+        {
+            .command = "rtc_bench",
+            .help = "Time ds1307_get_datetime and full RAM reads",
+            .hint = "[iterations]",
+            .func = cmd_bench,
+        },
+    };
+    for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        ESP_RETURN_ON_ERROR(esp_console_cmd_register(&cmds[i]), TAG,
+                            "register %s failed", cmds[i].command);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,269 @@
+#include "ds1307_ram_region.h"
+#include "esp_check.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MERGE_GAP 2 // clean bytes worth rewriting to save a transaction
+
+static const char TAG[] = "ds1307_ram_region";
+
+struct ds1307_ram_region_t {
+    char name[DS1307_RAM_REGION_NAME_MAX];
+    uint8_t offset;        /*!< RAM offset of the first byte */
+    uint8_t size;
+    uint32_t seq;          /*!< Odd while staging is being written */
+    bool dirty;            /*!< Staging differs from the chip */
+    portMUX_TYPE spinlock; /*!< Serializes writers of this region */
+    uint8_t staging[];
+};
+
+struct ds1307_ram_pool_t {
+    ds1307_handle_t ds1307_handle;
+    uint8_t end;  /*!< One past the last RAM byte of the pool */
+    uint8_t next; /*!< RAM offset the next region starts at */
+    uint8_t region_count;
+    ds1307_ram_region_handle_t regions[DS1307_RAM_REGIONS_MAX];
+    uint8_t image[DS1307_RAM_SIZE]; /*!< Chip contents as last read or
+                                         flushed, by RAM offset */
+    SemaphoreHandle_t flush_lock;   /*!< Serializes allocs and flushes */
+};
+
+/*
+ * Staging buffers are published like the driver's time cache, see
+ * cache_write_begin in ds1307.c. The bytes are copied as relaxed atomics,
+ * so the race with a writer that the retry covers is not a data race.
+ */
+static void staging_read(ds1307_ram_region_handle_t region, uint8_t offset,
+                         uint8_t *data, uint8_t size)
+{
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&region->seq, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < size; i++) {
+            data[i] = __atomic_load_n(&region->staging[offset + i],
+                                      __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) ||
+             seq != __atomic_load_n(&region->seq, __ATOMIC_RELAXED));
+}
+
+/* Write one run of regions, first to last, from buf */
+static esp_err_t write_run(ds1307_ram_pool_handle_t pool, const uint8_t *buf,
+                           const bool *flushing, int first, int last)
+{
+    uint8_t start = pool->regions[first]->offset;
+    uint8_t end = pool->regions[last]->offset + pool->regions[last]->size;
+    esp_err_t ret = ds1307_set_ram(pool->ds1307_handle, start, buf + start,
+                                   end - start);
+    if (ret == ESP_OK) {
+        memcpy(pool->image + start, buf + start, end - start);
+        return ESP_OK;
+    }
+    for (int i = first; i <= last; i++) {
+        if (flushing[i]) {
+            __atomic_store_n(&pool->regions[i]->dirty, true, __ATOMIC_RELAXED);
+        }
+    }
+    return ret;
+}
+
+esp_err_t ds1307_ram_pool_new(ds1307_handle_t ds1307_handle, uint8_t offset,
+                              uint8_t size, ds1307_ram_pool_handle_t *pool)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+    ESP_RETURN_ON_FALSE(pool, ESP_ERR_INVALID_ARG, TAG, "invalid args");
+    if (size == 0 && offset < DS1307_RAM_SIZE) {
+        size = DS1307_RAM_SIZE - offset;
+    }
+    ESP_RETURN_ON_FALSE(size > 0 && offset + size <= DS1307_RAM_SIZE,
+                        ESP_ERR_INVALID_ARG, TAG, "invalid range");
+
+    esp_err_t ret = ESP_OK;
+    ds1307_ram_pool_handle_t out = calloc(1, sizeof(struct ds1307_ram_pool_t));
+    ESP_GOTO_ON_FALSE(out, ESP_ERR_NO_MEM, err, TAG, "no memory for pool");
+    out->flush_lock = xSemaphoreCreateMutex();
+    ESP_GOTO_ON_FALSE(out->flush_lock, ESP_ERR_NO_MEM, err, TAG,
+                      "no memory for pool lock");
+    out->ds1307_handle = ds1307_handle;
+    out->next = offset;
+    out->end = offset + size;
+    *pool = out;
+    return ESP_OK;
+
+err:
+    free(out);
+    return ret;
+}
+
+esp_err_t ds1307_ram_pool_del(ds1307_ram_pool_handle_t pool)
+{
+    ESP_RETURN_ON_FALSE(pool, ESP_ERR_INVALID_ARG, TAG, "invalid pool");
+
+    for (int i = 0; i < pool->region_count; i++) {
+        free(pool->regions[i]);
+    }
+    vSemaphoreDelete(pool->flush_lock);
+    free(pool);
+    return ESP_OK;
+}
+
+esp_err_t ds1307_ram_region_alloc(ds1307_ram_pool_handle_t pool,
+                                  const char *name, uint8_t size,
+                                  ds1307_ram_region_handle_t *region)
+{
+    ESP_RETURN_ON_FALSE(pool && name && region && size, ESP_ERR_INVALID_ARG,
+                        TAG, "invalid args");
+    ESP_RETURN_ON_FALSE(strlen(name) < DS1307_RAM_REGION_NAME_MAX,
+                        ESP_ERR_INVALID_ARG, TAG, "name too long");
+
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(pool->flush_lock, portMAX_DELAY);
+    ds1307_ram_region_handle_t out = NULL, found;
+    ESP_GOTO_ON_FALSE(ds1307_ram_region_find(pool, name, &found) ==
+                          ESP_ERR_NOT_FOUND,
+                      ESP_ERR_INVALID_ARG, err, TAG,
+                      "region %s already exists", name);
+    ESP_GOTO_ON_FALSE(pool->region_count < DS1307_RAM_REGIONS_MAX &&
+                          size <= pool->end - pool->next,
+                      ESP_ERR_NO_MEM, err, TAG, "no room for region %s", name);
+    out = calloc(1, sizeof(struct ds1307_ram_region_t) + size);
+    ESP_GOTO_ON_FALSE(out, ESP_ERR_NO_MEM, err, TAG, "no memory for region");
+    strcpy(out->name, name);
+    out->offset = pool->next;
+    out->size = size;
+    portMUX_INITIALIZE(&out->spinlock);
+    ESP_GOTO_ON_ERROR(ds1307_get_ram(pool->ds1307_handle, out->offset,
+                                     out->staging, size),
+                      err, TAG, "load region %s failed", name);
+    memcpy(pool->image + out->offset, out->staging, size);
+    pool->next += size;
+    // publish last: find and flush scan regions without the lock
+    __atomic_store_n(&pool->regions[pool->region_count], out,
+                     __ATOMIC_RELEASE);
+    __atomic_store_n(&pool->region_count, pool->region_count + 1,
+                     __ATOMIC_RELEASE);
+    *region = out;
+    xSemaphoreGive(pool->flush_lock);
+    return ESP_OK;
+
+err:
+    free(out);
+    xSemaphoreGive(pool->flush_lock);
+    return ret;
+}
+
+esp_err_t ds1307_ram_region_find(ds1307_ram_pool_handle_t pool,
+                                 const char *name,
+                                 ds1307_ram_region_handle_t *region)
+{
+    ESP_RETURN_ON_FALSE(pool && name && region, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid args");
+
+    uint8_t count = __atomic_load_n(&pool->region_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(pool->regions[i]->name, name) == 0) {
+            *region = pool->regions[i];
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t ds1307_ram_region_get_range(ds1307_ram_region_handle_t region,
+                                      uint8_t *offset, uint8_t *size)
+{
+    ESP_RETURN_ON_FALSE(region, ESP_ERR_INVALID_ARG, TAG, "invalid region");
+
+    if (offset) {
+        *offset = region->offset;
+    }
+    if (size) {
+        *size = region->size;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ds1307_ram_region_write(ds1307_ram_region_handle_t region,
+                                  uint8_t offset, const uint8_t *data,
+                                  uint8_t size)
+{
+    ESP_RETURN_ON_FALSE(region && data, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid args");
+    ESP_RETURN_ON_FALSE(offset + size <= region->size, ESP_ERR_INVALID_ARG,
+                        TAG, "range outside region %s", region->name);
+
+    portENTER_CRITICAL(&region->spinlock);
+    uint32_t seq = region->seq;
+    __atomic_store_n(&region->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (int i = 0; i < size; i++) {
+        __atomic_store_n(&region->staging[offset + i], data[i],
+                         __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&region->dirty, true, __ATOMIC_RELAXED);
+    __atomic_store_n(&region->seq, seq + 2, __ATOMIC_RELEASE);
+    portEXIT_CRITICAL(&region->spinlock);
+    return ESP_OK;
+}
+
+esp_err_t ds1307_ram_region_read(ds1307_ram_region_handle_t region,
+                                 uint8_t offset, uint8_t *data, uint8_t size)
+{
+    ESP_RETURN_ON_FALSE(region && data, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid args");
+    ESP_RETURN_ON_FALSE(offset + size <= region->size, ESP_ERR_INVALID_ARG,
+                        TAG, "range outside region %s", region->name);
+
+    staging_read(region, offset, data, size);
+    return ESP_OK;
+}
+
+esp_err_t ds1307_ram_pool_flush(ds1307_ram_pool_handle_t pool)
+{
+    ESP_RETURN_ON_FALSE(pool, ESP_ERR_INVALID_ARG, TAG, "invalid pool");
+
+    esp_err_t ret = ESP_OK;
+    uint8_t buf[DS1307_RAM_SIZE];
+    bool flushing[DS1307_RAM_REGIONS_MAX] = {0};
+    xSemaphoreTake(pool->flush_lock, portMAX_DELAY);
+    memcpy(buf, pool->image, sizeof(buf));
+    // clear dirty before the copy: a write racing the copy sets it again
+    for (int i = 0; i < pool->region_count; i++) {
+        ds1307_ram_region_handle_t region = pool->regions[i];
+        flushing[i] =
+            __atomic_exchange_n(&region->dirty, false, __ATOMIC_ACQUIRE);
+        if (flushing[i]) {
+            staging_read(region, 0, buf + region->offset, region->size);
+        }
+    }
+    // regions are back to back, so only clean regions separate dirty ones
+    int first = -1, last = -1;
+    for (int i = 0; i < pool->region_count; i++) {
+        if (!flushing[i]) {
+            continue;
+        }
+        if (first >= 0 && pool->regions[i]->offset -
+                                  (pool->regions[last]->offset +
+                                   pool->regions[last]->size) >
+                              MERGE_GAP) {
+            esp_err_t err = write_run(pool, buf, flushing, first, last);
+            ret = ret == ESP_OK ? err : ret;
+            first = -1;
+        }
+        if (first < 0) {
+            first = i;
+        }
+        last = i;
+    }
+    if (first >= 0) {
+        esp_err_t err = write_run(pool, buf, flushing, first, last);
+        ret = ret == ESP_OK ? err : ret;
+    }
+    xSemaphoreGive(pool->flush_lock);
+    ESP_RETURN_ON_ERROR(ret, TAG, "write regions failed");
+    return ESP_OK;
+}
@@ -0,0 +1,146 @@
+#include "ds1307_time_source.h"
+#include "esp_check.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char TAG[] = "ds1307_time_source";
+
+struct ds1307_time_selector_t {
+    ds1307_time_source_t sources[DS1307_TIME_SOURCE_MAX]; /*!< By cost */
+    int count;
+};
+
+static esp_err_t system_read(void *ctx, struct timeval *tv)
+{
+    return gettimeofday(tv, NULL) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t rtc_read(void *ctx, struct timeval *tv)
+{
+    return ds1307_get_timeval((ds1307_handle_t)ctx, tv);
+}
+
+esp_err_t ds1307_time_source_system(uint32_t accuracy_ms,
+                                    ds1307_time_source_t *source)
+{
+    ESP_RETURN_ON_FALSE(source, ESP_ERR_INVALID_ARG, TAG, "invalid source");
+
+    *source = (ds1307_time_source_t){
+        .name = "system",
+        .resolution_us = 1,
+        .accuracy_ms = accuracy_ms,
+        .read_cost_us = 1,
+        .read = system_read,
+    };
+    return ESP_OK;
+}
+
+esp_err_t ds1307_time_source_rtc(ds1307_handle_t ds1307_handle,
+                                 uint32_t accuracy_ms,
+                                 ds1307_time_source_t *source)
+{
+    ESP_RETURN_ON_FALSE(ds1307_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid ds1307 handle");
+    ESP_RETURN_ON_FALSE(source, ESP_ERR_INVALID_ARG, TAG, "invalid source");
+
+    *source = (ds1307_time_source_t){
+        .name = "ds1307",
+        .resolution_us = 1, // extrapolated, see ds1307_time_source_rtc
+        .accuracy_ms = accuracy_ms,
+        .read_cost_us = DS1307_TIME_SOURCE_RTC_COST_US,
+        .read = rtc_read,
+        .ctx = ds1307_handle,
+    };
+    return ESP_OK;
+}
+
+esp_err_t ds1307_time_selector_new(ds1307_time_selector_handle_t *selector)
+{
+    ESP_RETURN_ON_FALSE(selector, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid selector");
+
+    *selector = calloc(1, sizeof(struct ds1307_time_selector_t));
+    ESP_RETURN_ON_FALSE(*selector, ESP_ERR_NO_MEM, TAG,
+                        "no memory for time selector");
+    return ESP_OK;
+}
+
+esp_err_t ds1307_time_selector_del(ds1307_time_selector_handle_t selector)
+{
+    ESP_RETURN_ON_FALSE(selector, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid selector");
+
+    free(selector);
+    return ESP_OK;
+}
+
+esp_err_t ds1307_time_selector_add(ds1307_time_selector_handle_t selector,
+                                   const ds1307_time_source_t *source)
+{
+    ESP_RETURN_ON_FALSE(selector, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid selector");
+    ESP_RETURN_ON_FALSE(source && source->read, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid source");
+    ESP_RETURN_ON_FALSE(selector->count < DS1307_TIME_SOURCE_MAX,
+                        ESP_ERR_NO_MEM, TAG, "too many time sources");
+
+    int i = selector->count++;
+    for (; i > 0 && selector->sources[i - 1].read_cost_us >
+                        source->read_cost_us;
+         i--) {
+        selector->sources[i] = selector->sources[i - 1];
+    }
+    selector->sources[i] = *source;
+    return ESP_OK;
+}
+
+esp_err_t ds1307_time_selector_set_accuracy(
+    ds1307_time_selector_handle_t selector, const char *name,
+    uint32_t accuracy_ms)
+{
+    ESP_RETURN_ON_FALSE(selector && name, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid args");
+
+    for (int i = 0; i < selector->count; i++) {
+        ds1307_time_source_t *source = &selector->sources[i];
+        if (source->name && strcmp(source->name, name) == 0) {
+            // readers in other tasks load it without a lock
+            __atomic_store_n(&source->accuracy_ms, accuracy_ms,
+                             __ATOMIC_RELAXED);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t ds1307_time_selector_read(ds1307_time_selector_handle_t selector,
+                                    uint32_t accuracy_ms, struct timeval *tv,
+                                    const char **source)
+{
+    ESP_RETURN_ON_FALSE(selector, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid selector");
+    ESP_RETURN_ON_FALSE(tv, ESP_ERR_INVALID_ARG, TAG, "invalid timeval");
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    for (int i = 0; i < selector->count; i++) {
+        const ds1307_time_source_t *candidate = &selector->sources[i];
+        // a reading is off by up to its accuracy plus one resolution step,
+        // rounded up so that a sub-millisecond step still counts
+        uint64_t error_ms =
+            __atomic_load_n(&candidate->accuracy_ms, __ATOMIC_RELAXED) +
+            ((uint64_t)candidate->resolution_us + 999) / 1000;
+        if (error_ms > accuracy_ms) {
+            continue;
+        }
+        ret = candidate->read(candidate->ctx, tv);
+        if (ret == ESP_OK) {
+            if (source) {
+                *source = candidate->name;
+            }
+            return ESP_OK;
+        }
+        ESP_LOGW(TAG, "%s read failed: %s", candidate->name,
+                 esp_err_to_name(ret));
+    }
+    return ret;
+}
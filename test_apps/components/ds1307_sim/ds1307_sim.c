@@ -0,0 +1,502 @@
+#include "ds1307_sim.h"
+#include "Mockesp_timer.h"
+#include "Mocki2c_master.h"
+#include "freertos/FreeRTOS.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/***
+ * DS1307 register model: the seconds countdown restarts when register 0 is
+ * written, CH stops it, the calendar takes every year 00 for a leap year and
+ * the register pointer wraps from 0x3F to 0x00, like the chip.
+ ***/
+
+#define DS1307_ADDRESS 0x68
+#define EEPROM_ADDRESS 0x50
+#define REG_COUNT 64
+#define TIME_REGS 7
+#define CH_BIT 0x80
+#define HOUR_12_BIT 0x40
+#define HOUR_PM_BIT 0x20
+#define EEPROM_PAGE_SIZE 32
+#define TICK_US 1000000
+#define HOUR_TICKS 3600
+
+struct i2c_master_bus_t {
+    int unused;
+};
+
+struct i2c_master_dev_t {
+    uint16_t address;
+};
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct i2c_master_bus_t s_bus;
+static int64_t s_host_base_us; /*!< Host time the virtual clock started */
+static int64_t s_skip_us;      /*!< Added by ds1307_sim_skip */
+static int64_t s_next_tick_us; /*!< Virtual time of the next seconds tick */
+static uint8_t s_regs[REG_COUNT];
+static uint64_t s_read_mask;   /*!< Registers covered by the last read */
+static uint64_t s_stale_mask;  /*!< Of those, changed by a tick since */
+static uint32_t s_stale_writes;
+static uint32_t s_ticks;
+static bool s_tick_before_write;
+static esp_err_t s_fail_next;
+static uint32_t s_bus_hz;
+static bool s_eeprom_present;
+static int64_t s_eeprom_busy_us; /*!< End of the EEPROM write cycle */
+static uint8_t s_eeprom[DS1307_SIM_EEPROM_SIZE];
+static ds1307_sim_xfer_t s_log[DS1307_SIM_LOG_MAX];
+static size_t s_log_count;
+
+static uint8_t bcd(int x) { return ((x / 10) << 4) | (x % 10); }
+
+static int dec(uint8_t x) { return (x >> 4) * 10 + (x & 0x0f); }
+
+static int64_t host_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int64_t now_us(void) { return host_us() - s_host_base_us + s_skip_us; }
+
+static int month_days(int month, int year)
+{
+    static const uint8_t days[] = {31, 28, 31, 30, 31, 30,
+                                   31, 31, 30, 31, 30, 31};
+    return month == 2 && year % 4 == 0 ? 29 : days[month - 1];
+}
+
+/* One seconds tick, carried through the calendar like the chip does */
+static void tick(void)
+{
+    s_ticks++;
+    int sec = dec(s_regs[0] & ~CH_BIT) + 1;
+    if (sec < 60) {
+        s_regs[0] = (s_regs[0] & CH_BIT) | bcd(sec);
+        return;
+    }
+    s_regs[0] &= CH_BIT;
+    int min = dec(s_regs[1]) + 1;
+    if (min < 60) {
+        s_regs[1] = bcd(min);
+        return;
+    }
+    s_regs[1] = 0;
+    if (s_regs[2] & HOUR_12_BIT) {
+        int hour = dec(s_regs[2] & 0x1f), pm = s_regs[2] & HOUR_PM_BIT;
+        if (hour != 11) {
+            s_regs[2] = HOUR_12_BIT | pm | bcd(hour == 12 ? 1 : hour + 1);
+            return;
+        }
+        s_regs[2] = HOUR_12_BIT | (pm ? 0 : HOUR_PM_BIT) | bcd(12);
+        if (!pm) {
+            return; // 11 AM to 12 PM
+        }
+    } else {
+        int hour = dec(s_regs[2]) + 1;
+        if (hour < 24) {
+            s_regs[2] = bcd(hour);
+            return;
+        }
+        s_regs[2] = 0;
+    }
+    s_regs[3] = s_regs[3] % 7 + 1;
+    int date = dec(s_regs[4]) + 1, month = dec(s_regs[5]);
+    int year = dec(s_regs[6]);
+    if (date <= month_days(month, year)) {
+        s_regs[4] = bcd(date);
+        return;
+    }
+    s_regs[4] = 1;
+    if (month < 12) {
+        s_regs[5] = bcd(month + 1);
+        return;
+    }
+    s_regs[5] = 1;
+    s_regs[6] = bcd((year + 1) % 100);
+}
+
+/* Tick and remember which registers changed under the last read */
+static void tick_tracked(void)
+{
+    uint8_t before[TIME_REGS];
+    memcpy(before, s_regs, sizeof(before));
+    tick();
+    for (int i = 0; i < TIME_REGS; i++) {
+        if (s_regs[i] != before[i]) {
+            s_stale_mask |= (1ULL << i) & s_read_mask;
+        }
+    }
+}
+
+/* Catch the chip up with the virtual clock */
+static void run(void)
+{
+    int64_t now = now_us();
+    if (now < s_next_tick_us) {
+        return;
+    }
+    int64_t count = (now - s_next_tick_us) / TICK_US + 1;
+    s_next_tick_us += count * TICK_US;
+    if (s_regs[0] & CH_BIT) {
+        return;
+    }
+    while (count > 0) {
+        // jump to xx:59:59, then tick over the hour like the chip
+        int in_hour = dec(s_regs[1]) * 60 + dec(s_regs[0]);
+        int64_t jump = HOUR_TICKS - 1 - in_hour;
+        if (jump > 0 && count > jump) {
+            uint8_t before[2] = {s_regs[0], s_regs[1]};
+            s_regs[0] = bcd(59);
+            s_regs[1] = bcd(59);
+            for (int i = 0; i < 2; i++) {
+                if (s_regs[i] != before[i]) {
+                    s_stale_mask |= (1ULL << i) & s_read_mask;
+                }
+            }
+            s_ticks += jump;
+            count -= jump;
+        }
+        tick_tracked();
+        count--;
+    }
+}
+
+static void log_xfer(uint16_t address, bool read, uint16_t reg,
+                     const uint8_t *data, size_t size, esp_err_t ret)
+{
+    if (s_log_count < DS1307_SIM_LOG_MAX) {
+        ds1307_sim_xfer_t *xfer = &s_log[s_log_count];
+        xfer->address = address;
+        xfer->read = read;
+        xfer->reg = reg;
+        xfer->size = size;
+        if (size) {
+            memcpy(xfer->data, data,
+                   size < DS1307_SIM_DATA_MAX ? size : DS1307_SIM_DATA_MAX);
+        }
+        xfer->at_us = now_us();
+        xfer->ret = ret;
+    }
+    s_log_count++;
+}
+
+static void regs_write(uint8_t reg, const uint8_t *data, size_t size)
+{
+    uint64_t covered = 0;
+    for (size_t i = 0; i < size; i++) {
+        uint8_t at = (reg + i) % REG_COUNT;
+        s_regs[at] = data[i];
+        covered |= 1ULL << at;
+    }
+    if (covered & s_stale_mask) {
+        s_stale_writes++;
+    }
+    s_stale_mask &= ~covered;
+    if (covered & 1) { // writing seconds restarts the countdown chain
+        s_next_tick_us = now_us() + TICK_US;
+    }
+}
+
+static void regs_read(uint8_t reg, uint8_t *data, size_t size)
+{
+    s_read_mask = 0;
+    for (size_t i = 0; i < size; i++) {
+        uint8_t at = (reg + i) % REG_COUNT;
+        data[i] = s_regs[at];
+        s_read_mask |= 1ULL << at;
+    }
+    s_stale_mask = 0;
+}
+
+static esp_err_t ds1307_transmit(const uint8_t *buf, size_t size)
+{
+    if (s_fail_next != ESP_OK) {
+        esp_err_t ret = s_fail_next;
+        s_fail_next = ESP_OK;
+        log_xfer(DS1307_ADDRESS, false, buf[0], buf + 1, size - 1, ret);
+        return ret;
+    }
+    run();
+    if (s_tick_before_write) {
+        s_tick_before_write = false;
+        if (!(s_regs[0] & CH_BIT)) {
+            tick_tracked();
+            s_next_tick_us = now_us() + TICK_US;
+        }
+    }
+    regs_write(buf[0] % REG_COUNT, buf + 1, size - 1);
+    log_xfer(DS1307_ADDRESS, false, buf[0], buf + 1, size - 1, ESP_OK);
+    return ESP_OK;
+}
+
+static esp_err_t ds1307_receive(uint8_t reg, uint8_t *data, size_t size)
+{
+    esp_err_t ret = s_fail_next;
+    s_fail_next = ESP_OK;
+    if (ret == ESP_OK) {
+        run();
+        regs_read(reg % REG_COUNT, data, size);
+    }
+    log_xfer(DS1307_ADDRESS, true, reg, data, ret == ESP_OK ? size : 0, ret);
+    return ret;
+}
+
+/* AT24C32: NACKs when absent or inside its self-timed write cycle */
+static bool eeprom_acks(void)
+{
+    return s_eeprom_present && now_us() >= s_eeprom_busy_us;
+}
+
+static esp_err_t eeprom_transmit(const uint8_t *buf, size_t size)
+{
+    uint16_t addr = size >= 2 ? (buf[0] << 8 | buf[1]) : 0;
+    if (!eeprom_acks() || size < 2) {
+        log_xfer(EEPROM_ADDRESS, false, addr, NULL, 0, ESP_FAIL);
+        return ESP_FAIL;
+    }
+    addr %= DS1307_SIM_EEPROM_SIZE;
+    uint16_t page = addr - addr % EEPROM_PAGE_SIZE;
+    for (size_t i = 2; i < size; i++) { // page writes wrap within the page
+        s_eeprom[page + (addr - page + i - 2) % EEPROM_PAGE_SIZE] = buf[i];
+    }
+    if (size > 2) {
+        s_eeprom_busy_us = now_us() + DS1307_SIM_EEPROM_WRITE_US;
+    }
+    log_xfer(EEPROM_ADDRESS, false, addr, buf + 2, size - 2, ESP_OK);
+    return ESP_OK;
+}
+
+static esp_err_t eeprom_receive(const uint8_t *buf, size_t size,
+                                uint8_t *data, size_t data_size)
+{
+    uint16_t addr = size >= 2 ? (buf[0] << 8 | buf[1]) : 0;
+    if (!eeprom_acks() || size != 2) {
+        log_xfer(EEPROM_ADDRESS, true, addr, NULL, 0, ESP_FAIL);
+        return ESP_FAIL;
+    }
+    for (size_t i = 0; i < data_size; i++) { // reads roll over the array
+        data[i] = s_eeprom[(addr + i) % DS1307_SIM_EEPROM_SIZE];
+    }
+    log_xfer(EEPROM_ADDRESS, true, addr, data, data_size, ESP_OK);
+    return ESP_OK;
+}
+
+static esp_err_t new_master_bus(const i2c_master_bus_config_t *bus_config,
+                                i2c_master_bus_handle_t *ret_bus_handle,
+                                int cmock_num_calls)
+{
+    *ret_bus_handle = &s_bus;
+    return ESP_OK;
+}
+
+static esp_err_t del_master_bus(i2c_master_bus_handle_t bus_handle,
+                                int cmock_num_calls)
+{
+    return ESP_OK;
+}
+
+static esp_err_t add_device(i2c_master_bus_handle_t bus_handle,
+                            const i2c_device_config_t *dev_config,
+                            i2c_master_dev_handle_t *ret_handle,
+                            int cmock_num_calls)
+{
+    if (!bus_handle || !dev_config || !ret_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    i2c_master_dev_handle_t dev = calloc(1, sizeof(struct i2c_master_dev_t));
+    if (!dev) {
+        return ESP_ERR_NO_MEM;
+    }
+    dev->address = dev_config->device_address;
+    *ret_handle = dev;
+    return ESP_OK;
+}
+
+static esp_err_t rm_device(i2c_master_dev_handle_t handle, int cmock_num_calls)
+{
+    free(handle);
+    return ESP_OK;
+}
+
+/* Hold the caller for the wire time of a transaction, outside the lock */
+static void bus_time(size_t bytes)
+{
+    uint32_t hz = s_bus_hz;
+    if (hz) { // start, address and stop, 9 clocks a byte with its ack
+        usleep((11 + 9 * (bytes + 1)) * 1000000ULL / hz);
+    }
+}
+
+static esp_err_t transmit(i2c_master_dev_handle_t i2c_dev,
+                          const uint8_t *write_buffer, size_t write_size,
+                          int xfer_timeout_ms, int cmock_num_calls)
+{
+    esp_err_t ret = ESP_FAIL;
+    portENTER_CRITICAL(&s_lock);
+    if (i2c_dev->address == DS1307_ADDRESS && write_size >= 1) {
+        ret = ds1307_transmit(write_buffer, write_size);
+    } else if (i2c_dev->address == EEPROM_ADDRESS) {
+        ret = eeprom_transmit(write_buffer, write_size);
+    } else {
+        log_xfer(i2c_dev->address, false, 0, NULL, 0, ret);
+    }
+    portEXIT_CRITICAL(&s_lock);
+    bus_time(write_size);
+    return ret;
+}
+
+static esp_err_t transmit_receive(i2c_master_dev_handle_t i2c_dev,
+                                  const uint8_t *write_buffer,
+                                  size_t write_size, uint8_t *read_buffer,
+                                  size_t read_size, int xfer_timeout_ms,
+                                  int cmock_num_calls)
+{
+    esp_err_t ret = ESP_FAIL;
+    portENTER_CRITICAL(&s_lock);
+    if (i2c_dev->address == DS1307_ADDRESS && write_size == 1) {
+        ret = ds1307_receive(write_buffer[0], read_buffer, read_size);
+    } else if (i2c_dev->address == EEPROM_ADDRESS) {
+        ret = eeprom_receive(write_buffer, write_size, read_buffer,
+                             read_size);
+    } else {
+        log_xfer(i2c_dev->address, true, 0, NULL, 0, ret);
+    }
+    portEXIT_CRITICAL(&s_lock);
+    bus_time(write_size + 1 + read_size); // repeated start and address
+    return ret;
+}
+
+static esp_err_t probe(i2c_master_bus_handle_t bus_handle, uint16_t address,
+                       int xfer_timeout_ms, int cmock_num_calls)
+{
+    if (address == DS1307_ADDRESS ||
+        (address == EEPROM_ADDRESS && s_eeprom_present)) {
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+static int64_t get_time(int cmock_num_calls)
+{
+    portENTER_CRITICAL(&s_lock);
+    int64_t now = now_us();
+    portEXIT_CRITICAL(&s_lock);
+    return now;
+}
+
+void ds1307_sim_attach(void)
+{
+    static const uint8_t power_on[] = {CH_BIT, 0x00, 0x00, 0x01,
+                                       0x01,   0x01, 0x00, 0x03};
+    portENTER_CRITICAL(&s_lock);
+    s_host_base_us = host_us();
+    s_skip_us = 0;
+    s_next_tick_us = TICK_US;
+    memset(s_regs, 0, sizeof(s_regs));
+    memcpy(s_regs, power_on, sizeof(power_on));
+    s_read_mask = 0;
+    s_stale_mask = 0;
+    s_stale_writes = 0;
+    s_ticks = 0;
+    s_tick_before_write = false;
+    s_fail_next = ESP_OK;
+    s_bus_hz = 0;
+    s_eeprom_present = true;
+    s_eeprom_busy_us = 0;
+    memset(s_eeprom, 0xff, sizeof(s_eeprom));
+    s_log_count = 0;
+    portEXIT_CRITICAL(&s_lock);
+
+    i2c_new_master_bus_Stub(new_master_bus);
+    i2c_del_master_bus_Stub(del_master_bus);
+    i2c_master_bus_add_device_Stub(add_device);
+    i2c_master_bus_rm_device_Stub(rm_device);
+    i2c_master_transmit_Stub(transmit);
+    i2c_master_transmit_receive_Stub(transmit_receive);
+    i2c_master_probe_Stub(probe);
+    esp_timer_get_time_Stub(get_time);
+}
+
+void ds1307_sim_skip(int64_t us)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_skip_us += us;
+    run();
+    portEXIT_CRITICAL(&s_lock);
+}
+
+int64_t ds1307_sim_now(void) { return get_time(0); }
+
+void ds1307_sim_write(uint8_t reg, const uint8_t *data, size_t size)
+{
+    portENTER_CRITICAL(&s_lock);
+    run();
+    regs_write(reg, data, size);
+    s_stale_mask = 0; // not a write-back of the driver's
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void ds1307_sim_read(uint8_t reg, uint8_t *data, size_t size)
+{
+    portENTER_CRITICAL(&s_lock);
+    run();
+    for (size_t i = 0; i < size; i++) {
+        data[i] = s_regs[(reg + i) % REG_COUNT];
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void ds1307_sim_set_next_tick(int64_t us)
+{
+    portENTER_CRITICAL(&s_lock);
+    run();
+    s_next_tick_us = now_us() + us;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void ds1307_sim_tick_before_write(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_tick_before_write = true;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+uint32_t ds1307_sim_stale_writes(void) { return s_stale_writes; }
+
+uint32_t ds1307_sim_ticks(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    run();
+    uint32_t ticks = s_ticks;
+    portEXIT_CRITICAL(&s_lock);
+    return ticks;
+}
+
+void ds1307_sim_fail_next(esp_err_t err) { s_fail_next = err; }
+
+void ds1307_sim_set_bus_speed(uint32_t hz) { s_bus_hz = hz; }
+
+void ds1307_sim_eeprom_present(bool present) { s_eeprom_present = present; }
+
+uint8_t *ds1307_sim_eeprom(void) { return s_eeprom; }
+
+size_t ds1307_sim_log_count(void) { return s_log_count; }
+
+const ds1307_sim_xfer_t *ds1307_sim_log(size_t index)
+{
+    return index < s_log_count && index < DS1307_SIM_LOG_MAX ? &s_log[index]
+                                                             : NULL;
+}
+
+void ds1307_sim_log_clear(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_log_count = 0;
+    portEXIT_CRITICAL(&s_lock);
+}
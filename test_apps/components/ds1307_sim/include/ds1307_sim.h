@@ -0,0 +1,140 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DS1307_SIM_LOG_MAX (512)
+#define DS1307_SIM_DATA_MAX (64) // bytes of each transaction kept in the log
+#define DS1307_SIM_EEPROM_SIZE (4096) // AT24C32
+#define DS1307_SIM_EEPROM_WRITE_US (5000)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint16_t address;                  /*!< 7-bit device address */
+    bool read;                         /*!< transmit_receive, else transmit */
+    uint16_t reg;                      /*!< Register or EEPROM word address */
+    uint16_t size;                     /*!< Data bytes after the pointer */
+    uint8_t data[DS1307_SIM_DATA_MAX]; /*!< The first data bytes */
+    int64_t at_us;                     /*!< Virtual esp_timer time */
+    esp_err_t ret;                     /*!< What the transaction returned */
+} ds1307_sim_xfer_t;
+
+/**
+ * @brief Route the I2C and esp_timer mocks to the simulated devices
+ *
+ * Installs CMock stubs for i2c_master.h and esp_timer_get_time and resets
+ * the simulation: a DS1307 at 0x68 in its power-on state (halted at
+ * 2000-01-01 00:00:00, control register 0x03, RAM cleared) and an empty
+ * AT24C32 at 0x50. Call from setUp, after the mocks' Init.
+ *
+ * The virtual clock runs with the host monotonic clock, so FreeRTOS delays
+ * move it too, plus whatever ds1307_sim_skip added. The chip's seconds
+ * countdown restarts whenever the seconds register is written, like the
+ * real chip.
+ */
+void ds1307_sim_attach(void);
+
+/**
+ * @brief Advance the virtual clock, ticking the chip on the way
+ *
+ * Long skips are fast forwarded an hour at a time, so years take
+ * milliseconds.
+ *
+ * @param[in] us Microseconds to add
+ */
+void ds1307_sim_skip(int64_t us);
+
+/**
+ * @brief Get the virtual esp_timer time
+ */
+int64_t ds1307_sim_now(void);
+
+/**
+ * @brief Write DS1307 registers as another bus master would
+ *
+ * Not logged. Writing register 0 restarts the seconds countdown.
+ */
+void ds1307_sim_write(uint8_t reg, const uint8_t *data, size_t size);
+
+/**
+ * @brief Read DS1307 registers without a logged transaction
+ */
+void ds1307_sim_read(uint8_t reg, uint8_t *data, size_t size);
+
+/**
+ * @brief Move the chip's next seconds tick, without telling the driver
+ *
+ * @param[in] us Microseconds from now
+ */
+void ds1307_sim_set_next_tick(int64_t us);
+
+/**
+ * @brief Tick the chip right before the next write transaction lands
+ *
+ * The worst moment for a read-modify-write; see ds1307_sim_stale_writes.
+ */
+void ds1307_sim_tick_before_write(void);
+
+/**
+ * @brief Count writes that put back a value a tick had already changed
+ *
+ * A register changed by a tick counts as stale until it is read again; a
+ * write that covers it while stale undoes the tick.
+ */
+uint32_t ds1307_sim_stale_writes(void);
+
+/**
+ * @brief Count the seconds ticks the chip has made
+ */
+uint32_t ds1307_sim_ticks(void);
+
+/**
+ * @brief Make the next transaction to the DS1307 fail with err
+ */
+void ds1307_sim_fail_next(esp_err_t err);
+
+/**
+ * @brief Make every transaction take its wire time, like a real bus
+ *
+ * The caller sleeps for the clocks of the transaction after it completed,
+ * so tasks sharing a handle contend for the driver lock as on hardware.
+ *
+ * @param[in] hz SCL frequency, 0 for instant transactions (the default)
+ */
+void ds1307_sim_set_bus_speed(uint32_t hz);
+
+/**
+ * @brief Attach or detach the AT24C32; a missing EEPROM NACKs
+ */
+void ds1307_sim_eeprom_present(bool present);
+
+/**
+ * @brief Access the AT24C32 contents directly
+ */
+uint8_t *ds1307_sim_eeprom(void);
+
+/**
+ * @brief Get the number of transactions logged since the last clear
+ */
+size_t ds1307_sim_log_count(void);
+
+/**
+ * @brief Get a logged transaction, oldest first
+ *
+ * Only the first DS1307_SIM_LOG_MAX transactions are kept.
+ */
+const ds1307_sim_xfer_t *ds1307_sim_log(size_t index);
+
+/**
+ * @brief Clear the transaction log
+ */
+void ds1307_sim_log_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+
+/*
+ * Host subset of the ESP-IDF I2C master driver API, with the same names and
+ * signatures. CMock generates Mocki2c_master.h from it.
+ */
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define I2C_CLK_SRC_DEFAULT (0)
+
+typedef int i2c_port_num_t;
+typedef int i2c_clock_source_t;
+typedef int gpio_num_t;
+
+typedef enum {
+    I2C_ADDR_BIT_LEN_7 = 0,
+    I2C_ADDR_BIT_LEN_10,
+} i2c_addr_bit_len_t;
+
+typedef struct i2c_master_bus_t *i2c_master_bus_handle_t;
+typedef struct i2c_master_dev_t *i2c_master_dev_handle_t;
+
+typedef struct {
+    i2c_port_num_t i2c_port;       /*!< I2C port number, -1 for auto */
+    gpio_num_t sda_io_num;         /*!< GPIO number of I2C SDA signal */
+    gpio_num_t scl_io_num;         /*!< GPIO number of I2C SCL signal */
+    i2c_clock_source_t clk_source; /*!< Clock source of I2C master bus */
+    uint8_t glitch_ignore_cnt;     /*!< Glitch period of the data line */
+    int intr_priority;             /*!< I2C interrupt priority */
+    size_t trans_queue_depth;      /*!< Depth of the transaction queue */
+    struct {
+        uint32_t enable_internal_pullup : 1; /*!< Enable internal pullups */
+        uint32_t allow_pd : 1;               /*!< Power down in light sleep */
+    } flags;
+} i2c_master_bus_config_t;
+
+typedef struct {
+    i2c_addr_bit_len_t dev_addr_length; /*!< Address length of the slave */
+    uint16_t device_address;            /*!< I2C device raw address */
+    uint32_t scl_speed_hz;              /*!< I2C SCL line frequency */
+    uint32_t scl_wait_us;               /*!< Timeout value, 0 for default */
+    struct {
+        uint32_t disable_ack_check : 1; /*!< Disable ACK check */
+    } flags;
+} i2c_device_config_t;
+
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t *bus_config,
+                             i2c_master_bus_handle_t *ret_bus_handle);
+
+esp_err_t i2c_del_master_bus(i2c_master_bus_handle_t bus_handle);
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus_handle,
+                                    const i2c_device_config_t *dev_config,
+                                    i2c_master_dev_handle_t *ret_handle);
+
+esp_err_t i2c_master_bus_rm_device(i2c_master_dev_handle_t handle);
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t i2c_dev,
+                              const uint8_t *write_buffer, size_t write_size,
+                              int xfer_timeout_ms);
+
+esp_err_t i2c_master_transmit_receive(i2c_master_dev_handle_t i2c_dev,
+                                      const uint8_t *write_buffer,
+                                      size_t write_size, uint8_t *read_buffer,
+                                      size_t read_size, int xfer_timeout_ms);
+
+esp_err_t i2c_master_receive(i2c_master_dev_handle_t i2c_dev,
+                             uint8_t *read_buffer, size_t read_size,
+                             int xfer_timeout_ms);
+
+esp_err_t i2c_master_probe(i2c_master_bus_handle_t bus_handle,
+                           uint16_t address, int xfer_timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+ * Host subset of the ESP-IDF esp_timer API, with the same names and
+ * signatures. CMock generates Mockesp_timer.h from it.
+ */
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct esp_timer *esp_timer_handle_t;
+
+typedef void (*esp_timer_cb_t)(void *arg);
+
+typedef enum {
+    ESP_TIMER_TASK,
+    ESP_TIMER_MAX,
+} esp_timer_dispatch_t;
+
+typedef struct {
+    esp_timer_cb_t callback;              /*!< Called when timer expires */
+    void *arg;                            /*!< Passed to callback */
+    esp_timer_dispatch_t dispatch_method; /*!< Dispatch from task or ISR */
+    const char *name;                     /*!< Timer name */
+    bool skip_unhandled_events;           /*!< Skip missed periodic events */
+} esp_timer_create_args_t;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args,
+                           esp_timer_handle_t *out_handle);
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer,
+                                   uint64_t period);
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
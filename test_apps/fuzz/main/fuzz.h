@@ -0,0 +1,54 @@
+#pragma once
+
+#include "ds1307.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define FUZZ_INPUT_MAX (256)
+
+/**
+ * @brief A fuzz target: run one input through the driver
+ *
+ * Broken invariants abort through FUZZ_CHECK, memory errors through the
+ * sanitizers.
+ *
+ * @return Signature of the outcomes the input reached; inputs with a new
+ *         signature are kept for further mutation
+ */
+typedef uint32_t (*fuzz_target_t)(const uint8_t *data, size_t size);
+
+/**
+ * @brief Check an invariant; on failure save the input and abort
+ */
+#define FUZZ_CHECK(cond)                                                       \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fuzz_fail(__FILE__, __LINE__, #cond);                              \
+        }                                                                      \
+    } while (0)
+
+void fuzz_fail(const char *file, int line, const char *expr);
+
+/**
+ * @brief Reset the simulated chip and create a handle on it
+ *
+ * The clock is halted, so nothing ticks under the checks.
+ */
+ds1307_handle_t fuzz_begin(int century, bool multi_master);
+
+/**
+ * @brief Delete the handle and the simulated bus
+ */
+void fuzz_end(ds1307_handle_t ds1307_handle);
+
+/**
+ * @brief Fold an outcome into a signature
+ */
+static inline uint32_t fuzz_mix(uint32_t signature, uint32_t value)
+{
+    return (signature ^ value) * 16777619u; // FNV-1a step
+}
+
+/* The targets */
+uint32_t fuzz_decode(const uint8_t *data, size_t size);
+uint32_t fuzz_api(const uint8_t *data, size_t size);
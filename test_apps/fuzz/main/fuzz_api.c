@@ -0,0 +1,303 @@
+/*
+ * Sequences of API calls with arbitrary arguments. The RAM accessors are
+ * checked against a shadow of what was written, in write-through and
+ * write-back mode, with and without the multi_master generation byte; time
+ * and control writes must read back as written, or be refused exactly when
+ * the arguments are out of range.
+ *
+ * Input: a flags byte (bit 0 multi_master), then operations: an opcode
+ * byte followed by its arguments. A short input reads as zeros.
+ */
+
+#include "ds1307_sim.h"
+#include "fuzz.h"
+#include <string.h>
+
+#define RAM_REG 8
+
+enum {
+    OP_SET_RAM,
+    OP_GET_RAM,
+    OP_FLUSH_RAM,
+    OP_WRITE_BACK,
+    OP_SET_DATETIME,
+    OP_SET_12_HOUR,
+    OP_SET_DATA,
+    OP_OTHER_MASTER,
+    OP_CONTROL,
+    OP_GET_REGISTERS,
+    OP_MAX,
+};
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    ds1307_handle_t ds1307_handle;
+    bool multi_master;
+    bool write_back;
+    uint8_t shadow[DS1307_RAM_SIZE]; /*!< What ds1307_get_ram must return */
+} api_t;
+
+static uint8_t next(api_t *api)
+{
+    if (!api->size) {
+        return 0;
+    }
+    api->size--;
+    return *api->data++;
+}
+
+static bool ram_valid(const api_t *api, uint8_t offset, uint8_t size)
+{
+    return size > 0 && offset + size <= DS1307_RAM_SIZE &&
+           (!api->multi_master || offset > DS1307_RAM_GEN_OFFSET);
+}
+
+/* The chip holds the shadow, except bytes staged for write-back */
+static void check_chip_ram(const api_t *api)
+{
+    uint8_t ram[DS1307_RAM_SIZE];
+    ds1307_sim_read(RAM_REG, ram, sizeof(ram));
+    for (int i = api->multi_master ? 1 : 0; i < DS1307_RAM_SIZE; i++) {
+        FUZZ_CHECK(ram[i] == api->shadow[i]);
+    }
+}
+
+static esp_err_t set_ram(api_t *api)
+{
+    uint8_t offset = next(api) % 64, size = next(api) % 64, data[64];
+    for (int i = 0; i < size; i++) {
+        data[i] = next(api);
+    }
+    esp_err_t ret = ds1307_set_ram(api->ds1307_handle, offset, data, size);
+    if (!ram_valid(api, offset, size)) {
+        FUZZ_CHECK(ret == ESP_ERR_INVALID_ARG);
+        return ret;
+    }
+    FUZZ_CHECK(ret == ESP_OK);
+    memcpy(api->shadow + offset, data, size);
+    return ret;
+}
+
+static esp_err_t get_ram(api_t *api)
+{
+    uint8_t offset = next(api) % 64, size = next(api) % 64, data[64];
+    esp_err_t ret = ds1307_get_ram(api->ds1307_handle, offset, data, size);
+    if (!ram_valid(api, offset, size)) {
+        FUZZ_CHECK(ret == ESP_ERR_INVALID_ARG);
+        return ret;
+    }
+    FUZZ_CHECK(ret == ESP_OK);
+    FUZZ_CHECK(memcmp(data, api->shadow + offset, size) == 0);
+    return ret;
+}
+
+static esp_err_t write_back(api_t *api)
+{
+    const ds1307_low_power_config_t low_power = {.ram_write_back = true};
+    api->write_back = !api->write_back;
+    esp_err_t ret = ds1307_set_low_power(api->ds1307_handle,
+                                         api->write_back ? &low_power : NULL);
+    FUZZ_CHECK(ret == ESP_OK);
+    return ret;
+}
+
+static bool tm_valid(const struct tm *tm)
+{
+    static const int days[] = {31, 28, 31, 30, 31, 30,
+                               31, 31, 30, 31, 30, 31};
+    if (tm->tm_mon < 0 || tm->tm_mon > 11) {
+        return false;
+    }
+    int year = tm->tm_year + 1900;
+    bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    return tm->tm_sec >= 0 && tm->tm_sec <= 59 && tm->tm_min >= 0 &&
+           tm->tm_min <= 59 && tm->tm_hour >= 0 && tm->tm_hour <= 23 &&
+           tm->tm_wday >= 0 && tm->tm_wday <= 6 && tm->tm_mday >= 1 &&
+           tm->tm_mday <= (tm->tm_mon == 1 && leap ? 29 : days[tm->tm_mon]);
+}
+
+static esp_err_t set_datetime(api_t *api)
+{
+    struct tm tm = {
+        .tm_sec = (int8_t)next(api),
+        .tm_min = (int8_t)next(api),
+        .tm_hour = (int8_t)next(api),
+        .tm_wday = (int8_t)next(api),
+        .tm_mday = (int8_t)next(api),
+        .tm_mon = (int8_t)next(api),
+        .tm_year = 100 + (int8_t)next(api),
+    };
+    esp_err_t ret = ds1307_set_datetime(api->ds1307_handle, &tm);
+    if (!tm_valid(&tm)) {
+        FUZZ_CHECK(ret == ESP_ERR_INVALID_ARG);
+        return ret;
+    }
+    FUZZ_CHECK(ret == ESP_OK);
+
+    // century 21: the year comes back as 20xx
+    struct tm want = tm, got;
+    want.tm_year = 100 + (tm.tm_year % 100 + 100) % 100;
+    FUZZ_CHECK(ds1307_get_datetime(api->ds1307_handle, &got) == ESP_OK);
+    FUZZ_CHECK(got.tm_sec == want.tm_sec && got.tm_min == want.tm_min &&
+               got.tm_hour == want.tm_hour && got.tm_wday == want.tm_wday &&
+               got.tm_mday == want.tm_mday && got.tm_mon == want.tm_mon &&
+               got.tm_year == want.tm_year);
+    return ret;
+}
+
+static esp_err_t set_12_hour(api_t *api)
+{
+    bool mode = next(api) & 1, got;
+    struct tm before, after;
+    esp_err_t valid = ds1307_get_datetime(api->ds1307_handle, &before);
+    FUZZ_CHECK(valid == ESP_OK || valid == ESP_ERR_INVALID_RESPONSE);
+    esp_err_t ret = ds1307_set_12_hour(api->ds1307_handle, mode);
+    FUZZ_CHECK(ret == ESP_OK || ret == ESP_ERR_INVALID_RESPONSE);
+    if (ret != ESP_OK) {
+        FUZZ_CHECK(valid != ESP_OK); // only a corrupt hour is refused
+        return ret;
+    }
+    FUZZ_CHECK(ds1307_get_12_hour(api->ds1307_handle, &got) == ESP_OK);
+    FUZZ_CHECK(got == mode);
+    if (valid == ESP_OK) {
+        FUZZ_CHECK(ds1307_get_datetime(api->ds1307_handle, &after) == ESP_OK);
+        FUZZ_CHECK(after.tm_hour == before.tm_hour);
+    }
+    return ret;
+}
+
+static esp_err_t set_data(api_t *api)
+{
+    uint8_t flags = next(api);
+    ds1307_data_t data = {
+        .second = next(api),
+        .minute = next(api),
+        .hour = next(api),
+        .day = next(api),
+        .date = next(api),
+        .month = next(api),
+        .year = next(api),
+        .hour_12 = flags & 1,
+        .hour_pm = (flags >> 1) & 1,
+    };
+    esp_err_t ret = ds1307_set_data(api->ds1307_handle, &data);
+    FUZZ_CHECK(ret == ESP_OK);
+
+    ds1307_data_t got;
+    FUZZ_CHECK(ds1307_get_data(api->ds1307_handle, &got) == ESP_OK);
+    FUZZ_CHECK(got.second == (data.second & 0x7f));
+    FUZZ_CHECK(got.minute == (data.minute & 0x7f));
+    FUZZ_CHECK(got.hour_12 == data.hour_12);
+    if (data.hour_12) {
+        FUZZ_CHECK(got.hour == (data.hour & 0x1f));
+        FUZZ_CHECK(got.hour_pm == data.hour_pm);
+    } else {
+        FUZZ_CHECK(got.hour == (data.hour & 0x3f));
+    }
+    FUZZ_CHECK(got.day == (data.day & 0x07));
+    FUZZ_CHECK(got.date == (data.date & 0x3f));
+    FUZZ_CHECK(got.month == (data.month & 0x1f));
+    FUZZ_CHECK(got.year == data.year);
+    bool halt;
+    FUZZ_CHECK(ds1307_get_halt(api->ds1307_handle, &halt) == ESP_OK);
+    FUZZ_CHECK(halt); // CH is kept
+    return ret;
+}
+
+/* Another master writes whatever time registers it likes */
+static esp_err_t other_master(api_t *api)
+{
+    uint8_t regs[7];
+    for (size_t i = 0; i < sizeof(regs); i++) {
+        regs[i] = next(api);
+    }
+    regs[0] |= 0x80;
+    ds1307_sim_write(0, regs, sizeof(regs));
+    struct tm tm;
+    esp_err_t ret = ds1307_get_datetime(api->ds1307_handle, &tm);
+    FUZZ_CHECK(ret == ESP_OK || ret == ESP_ERR_INVALID_RESPONSE);
+    return ret;
+}
+
+static esp_err_t control(api_t *api)
+{
+    uint8_t value = next(api);
+    bool output = value & 1, enable = value & 2, got_output, got_enable;
+    ds1307_rate_select_t rs = (value >> 2) & 3, got_rs;
+    FUZZ_CHECK(ds1307_set_output(api->ds1307_handle, output) == ESP_OK);
+    FUZZ_CHECK(ds1307_set_square_wave_enable(api->ds1307_handle, enable) ==
+               ESP_OK);
+    FUZZ_CHECK(ds1307_set_rate_select(api->ds1307_handle, rs) == ESP_OK);
+    FUZZ_CHECK(ds1307_get_output(api->ds1307_handle, &got_output) == ESP_OK);
+    FUZZ_CHECK(ds1307_get_square_wave_enable(api->ds1307_handle,
+                                             &got_enable) == ESP_OK);
+    FUZZ_CHECK(ds1307_get_rate_select(api->ds1307_handle, &got_rs) == ESP_OK);
+    FUZZ_CHECK(got_output == output && got_enable == enable && got_rs == rs);
+    uint8_t ctrl;
+    ds1307_sim_read(7, &ctrl, 1);
+    FUZZ_CHECK(ctrl == ((output ? 0x80 : 0) | (enable ? 0x10 : 0) | rs));
+    return ESP_OK;
+}
+
+static esp_err_t get_registers(api_t *api)
+{
+    uint8_t regs[DS1307_REG_IMAGE_SIZE], chip[DS1307_REG_IMAGE_SIZE];
+    FUZZ_CHECK(ds1307_get_registers(api->ds1307_handle, regs) == ESP_OK);
+    ds1307_sim_read(0, chip, sizeof(chip));
+    FUZZ_CHECK(memcmp(regs, chip, sizeof(chip)) == 0);
+    return ESP_OK;
+}
+
+uint32_t fuzz_api(const uint8_t *data, size_t size)
+{
+    api_t api = {.data = data, .size = size};
+    api.multi_master = next(&api) & 1;
+    api.ds1307_handle = fuzz_begin(21, api.multi_master);
+
+    uint32_t reached = api.multi_master; // bit 0, then a bit per outcome
+    while (api.size) {
+        uint8_t op = next(&api) % OP_MAX;
+        esp_err_t ret = ESP_OK;
+        switch (op) {
+        case OP_SET_RAM:
+            ret = set_ram(&api);
+            break;
+        case OP_GET_RAM:
+            ret = get_ram(&api);
+            break;
+        case OP_FLUSH_RAM:
+            FUZZ_CHECK(ds1307_flush_ram(api.ds1307_handle) == ESP_OK);
+            check_chip_ram(&api);
+            break;
+        case OP_WRITE_BACK:
+            ret = write_back(&api);
+            break;
+        case OP_SET_DATETIME:
+            ret = set_datetime(&api);
+            break;
+        case OP_SET_12_HOUR:
+            ret = set_12_hour(&api);
+            break;
+        case OP_SET_DATA:
+            ret = set_data(&api);
+            break;
+        case OP_OTHER_MASTER:
+            ret = other_master(&api);
+            break;
+        case OP_CONTROL:
+            ret = control(&api);
+            break;
+        default:
+            ret = get_registers(&api);
+            break;
+        }
+        if (!api.write_back) {
+            check_chip_ram(&api);
+        }
+        reached |= 1u << (1 + op * 2 + (ret != ESP_OK));
+    }
+
+    fuzz_end(api.ds1307_handle);
+    return fuzz_mix(2166136261u, reached);
+}
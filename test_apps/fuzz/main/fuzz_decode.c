@@ -0,0 +1,144 @@
+/*
+ * Arbitrary time registers through ds1307_get_datetime. An image is either
+ * decoded to what an independent reading of its BCD fields gives, or
+ * refused; what is decoded encodes back to the same registers with
+ * ds1307_set_datetime, and survives a 12/24-hour switch both ways.
+ *
+ * Input: seconds..year registers, then a century selector byte.
+ */
+
+#include "ds1307_sim.h"
+#include "fuzz.h"
+#include <string.h>
+
+#define TIME_REGS 7
+
+static bool bcd(uint8_t x, int min, int max, int *value)
+{
+    *value = (x >> 4) * 10 + (x & 0x0f);
+    return (x >> 4) <= 9 && (x & 0x0f) <= 9 && *value >= min && *value <= max;
+}
+
+/* Read the registers without the driver; the invalid field, or -1 */
+static int expect_tm(const uint8_t *regs, int century, struct tm *tm)
+{
+    int sec, min, hour, wday, mday, mon, year;
+    if (!bcd(regs[0] & 0x7f, 0, 59, &sec)) {
+        return 0;
+    }
+    if (!bcd(regs[1] & 0x7f, 0, 59, &min)) {
+        return 1;
+    }
+    if (regs[2] & 0x40) { // 12 AM is 0, 12 PM is 12
+        if (!bcd(regs[2] & 0x1f, 1, 12, &hour)) {
+            return 2;
+        }
+        hour = hour % 12 + ((regs[2] & 0x20) ? 12 : 0);
+    } else if (!bcd(regs[2] & 0x3f, 0, 23, &hour)) {
+        return 2;
+    }
+    if (!bcd(regs[3] & 0x07, 1, 7, &wday)) {
+        return 3;
+    }
+    if (!bcd(regs[4] & 0x3f, 1, 31, &mday)) {
+        return 4;
+    }
+    if (!bcd(regs[5] & 0x1f, 1, 12, &mon)) {
+        return 5;
+    }
+    if (!bcd(regs[6], 0, 99, &year)) {
+        return 6;
+    }
+    static const int days[] = {31, 28, 31, 30, 31, 30,
+                               31, 31, 30, 31, 30, 31};
+    if (mday > (mon == 2 && year % 4 == 0 ? 29 : days[mon - 1])) {
+        return 7; // the chip counts every fourth year as leap
+    }
+    *tm = (struct tm){
+        .tm_sec = sec,
+        .tm_min = min,
+        .tm_hour = hour,
+        .tm_wday = wday - 1,
+        .tm_mday = mday,
+        .tm_mon = mon - 1,
+        .tm_year = (century - 20) * 100 + year,
+    };
+    return -1;
+}
+
+static void check_tm(const struct tm *tm, const struct tm *want)
+{
+    FUZZ_CHECK(tm->tm_sec == want->tm_sec);
+    FUZZ_CHECK(tm->tm_min == want->tm_min);
+    FUZZ_CHECK(tm->tm_hour == want->tm_hour);
+    FUZZ_CHECK(tm->tm_wday == want->tm_wday);
+    FUZZ_CHECK(tm->tm_mday == want->tm_mday);
+    FUZZ_CHECK(tm->tm_mon == want->tm_mon);
+    FUZZ_CHECK(tm->tm_year == want->tm_year);
+}
+
+static void check_regs(const uint8_t *want)
+{
+    uint8_t regs[TIME_REGS];
+    ds1307_sim_read(0, regs, sizeof(regs));
+    FUZZ_CHECK(memcmp(regs, want, sizeof(regs)) == 0);
+}
+
+uint32_t fuzz_decode(const uint8_t *data, size_t size)
+{
+    uint8_t regs[TIME_REGS + 1] = {0};
+    memcpy(regs, data, size < sizeof(regs) ? size : sizeof(regs));
+    regs[0] |= 0x80; // halted
+    int century = 20 + regs[TIME_REGS] % 3;
+    ds1307_handle_t ds1307_handle = fuzz_begin(century, false);
+    ds1307_sim_write(0, regs, TIME_REGS);
+
+    struct tm tm, want;
+    esp_err_t ret = ds1307_get_datetime(ds1307_handle, &tm);
+    int invalid = expect_tm(regs, century, &want);
+    uint32_t signature = fuzz_mix(fuzz_mix(2166136261u, century), invalid);
+    if (invalid >= 0) {
+        FUZZ_CHECK(ret == ESP_ERR_INVALID_RESPONSE);
+        check_regs(regs); // refused, not repaired
+        fuzz_end(ds1307_handle);
+        return signature;
+    }
+    FUZZ_CHECK(ret == ESP_OK);
+
+    int year = want.tm_year + 1900;
+    bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    bool phantom = want.tm_mon == 1 && want.tm_mday == 29 && !leap;
+    if (phantom) {
+        want.tm_mon = 2; // the chip's phantom leap day, reported moved on
+        want.tm_mday = 1;
+        signature = fuzz_mix(signature, 29);
+    }
+    check_tm(&tm, &want);
+    check_regs(regs); // a getter never writes
+    if (phantom) { // what ds1307_set_datetime writes back
+        regs[4] = 0x01;
+        regs[5] = 0x03;
+    }
+
+    // registers as ds1307_set_datetime writes them: unused bits clear
+    uint8_t norm[TIME_REGS] = {
+        regs[0], regs[1] & 0x7f, regs[2] & 0x7f, regs[3] & 0x07,
+        regs[4] & 0x3f, regs[5] & 0x1f, regs[6],
+    };
+
+    FUZZ_CHECK(ds1307_set_datetime(ds1307_handle, &tm) == ESP_OK);
+    check_regs(norm);
+
+    bool hour_12 = regs[2] & 0x40, mode;
+    signature = fuzz_mix(fuzz_mix(signature, hour_12), want.tm_hour);
+    FUZZ_CHECK(ds1307_set_12_hour(ds1307_handle, !hour_12) == ESP_OK);
+    FUZZ_CHECK(ds1307_get_12_hour(ds1307_handle, &mode) == ESP_OK);
+    FUZZ_CHECK(mode == !hour_12);
+    FUZZ_CHECK(ds1307_get_datetime(ds1307_handle, &tm) == ESP_OK);
+    check_tm(&tm, &want);
+    FUZZ_CHECK(ds1307_set_12_hour(ds1307_handle, hour_12) == ESP_OK);
+    check_regs(norm);
+
+    fuzz_end(ds1307_handle);
+    return signature;
+}
@@ -0,0 +1,254 @@
+/*
+ * A small mutation fuzzer for the linux target: replay the corpus of each
+ * target, then mutate it for CONFIG_FUZZ_SECONDS, keeping inputs that reach
+ * a signature not seen before, and report executions per second.
+ */
+
+#include "Mockesp_timer.h"
+#include "Mocki2c_master.h"
+#include "ds1307_sim.h"
+#include "esp_log.h"
+#include "fuzz.h"
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define POOL_MAX 1024
+#define SEEN_MAX 8192 // power of two
+#define MUTATIONS_MAX 8
+
+typedef struct {
+    size_t size;
+    uint8_t data[FUZZ_INPUT_MAX];
+} fuzz_input_t;
+
+typedef struct {
+    const char *name;
+    fuzz_target_t run;
+} target_t;
+
+static const target_t targets[] = {
+    {"decode", fuzz_decode},
+    {"api", fuzz_api},
+};
+
+static fuzz_input_t pool[POOL_MAX];
+static size_t pool_size;
+static uint32_t seen[SEEN_MAX];
+static size_t seen_count;
+static const target_t *current;
+static const fuzz_input_t *current_input;
+static uint32_t rng_state;
+
+static const uint8_t interesting[] = {0x00, 0x01, 0x09, 0x0a, 0x12, 0x13,
+                                      0x1f, 0x20, 0x31, 0x32, 0x38, 0x40,
+                                      0x59, 0x5a, 0x60, 0x7f, 0x80, 0x99,
+                                      0x9a, 0xff};
+
+void fuzz_fail(const char *file, int line, const char *expr)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "crash-%s.bin", current->name);
+    FILE *f = fopen(path, "wb");
+    if (f) {
+        fwrite(current_input->data, 1, current_input->size, f);
+        fclose(f);
+    }
+    fprintf(stderr, "%s:%d: %s failed, input saved to %s\n", file, line,
+            expr, path);
+    abort();
+}
+
+ds1307_handle_t fuzz_begin(int century, bool multi_master)
+{
+    Mocki2c_master_Init();
+    Mockesp_timer_Init();
+    ds1307_sim_attach();
+    static const uint8_t halt = 0x80;
+    ds1307_sim_write(0, &halt, 1);
+
+    i2c_master_bus_config_t bus_config = {
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .i2c_port = -1,
+    };
+    i2c_master_bus_handle_t bus_handle;
+    FUZZ_CHECK(i2c_new_master_bus(&bus_config, &bus_handle) == ESP_OK);
+    const ds1307_config_t config = {
+        .ds1307_device.device_address = DS1307_ADDRESS,
+        .ds1307_device.scl_speed_hz = 100000,
+        .century = century,
+        .multi_master = multi_master,
+    };
+    ds1307_handle_t ds1307_handle;
+    FUZZ_CHECK(ds1307_init(bus_handle, &config, &ds1307_handle) == ESP_OK);
+    return ds1307_handle;
+}
+
+void fuzz_end(ds1307_handle_t ds1307_handle)
+{
+    FUZZ_CHECK(ds1307_deinit(ds1307_handle) == ESP_OK);
+    Mocki2c_master_Destroy();
+    Mockesp_timer_Destroy();
+}
+
+/* esp_timer is a mock, only routed to the sim inside fuzz_begin/fuzz_end */
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13; // xorshift32
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* Run one input; keep it if its signature is new */
+static void execute(const fuzz_input_t *input)
+{
+    current_input = input;
+    uint32_t signature = current->run(input->data, input->size);
+    signature = signature ? signature : 1; // 0 marks a free slot
+    size_t i = signature & (SEEN_MAX - 1);
+    while (seen[i] && seen[i] != signature) {
+        i = (i + 1) & (SEEN_MAX - 1);
+    }
+    if (seen[i] || seen_count == SEEN_MAX / 2) {
+        return;
+    }
+    seen[i] = signature;
+    seen_count++;
+    if (pool_size < POOL_MAX) {
+        pool[pool_size++] = *input;
+    }
+}
+
+static void mutate(fuzz_input_t *input)
+{
+    int count = 1 + rng() % MUTATIONS_MAX;
+    for (int n = 0; n < count; n++) {
+        size_t at = input->size ? rng() % input->size : 0;
+        switch (rng() % 6) {
+        case 0: // flip a bit
+            if (input->size) {
+                input->data[at] ^= 1 << (rng() % 8);
+            }
+            break;
+        case 1: // a random byte
+            if (input->size) {
+                input->data[at] = rng();
+            }
+            break;
+        case 2: // a value at a BCD or bit-field boundary
+            if (input->size) {
+                input->data[at] = interesting[rng() % sizeof(interesting)];
+            }
+            break;
+        case 3: // insert a byte
+            if (input->size < FUZZ_INPUT_MAX) {
+                memmove(input->data + at + 1, input->data + at,
+                        input->size - at);
+                input->data[at] = rng();
+                input->size++;
+            }
+            break;
+        case 4: // erase a byte
+            if (input->size) {
+                memmove(input->data + at, input->data + at + 1,
+                        input->size - at - 1);
+                input->size--;
+            }
+            break;
+        default: { // splice the tail of another input
+            const fuzz_input_t *other = &pool[rng() % pool_size];
+            size_t from = other->size ? rng() % other->size : 0;
+            size_t size = other->size - from;
+            if (at + size > FUZZ_INPUT_MAX) {
+                size = FUZZ_INPUT_MAX - at;
+            }
+            memcpy(input->data + at, other->data + from, size);
+            input->size = at + size;
+            break;
+        }
+        }
+    }
+}
+
+static size_t replay_corpus(void)
+{
+    char path[300];
+    snprintf(path, sizeof(path), "%s/%s", CONFIG_FUZZ_CORPUS_DIR,
+             current->name);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        printf("%s: no corpus in %s\n", current->name, path);
+        return 0;
+    }
+    size_t count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char file[600];
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        FILE *f = fopen(file, "rb");
+        if (!f) {
+            continue;
+        }
+        static fuzz_input_t input;
+        input.size = fread(input.data, 1, sizeof(input.data), f);
+        fclose(f);
+        execute(&input);
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+static void run_target(const target_t *target)
+{
+    current = target;
+    pool_size = 0;
+    seen_count = 0;
+    memset(seen, 0, sizeof(seen));
+    pool[pool_size++] = (fuzz_input_t){0}; // always something to mutate
+
+    int64_t start = now_us();
+    size_t seeds = replay_corpus();
+    uint64_t execs = 0;
+    int64_t end = start + CONFIG_FUZZ_SECONDS * 1000000LL, now = start;
+    while (now < end) {
+        for (int i = 0; i < 64; i++, execs++) {
+            static fuzz_input_t input;
+            input = pool[rng() % pool_size];
+            mutate(&input);
+            execute(&input);
+        }
+        now = now_us();
+    }
+    int64_t elapsed_ms = (now - start) / 1000;
+    printf("%s: %zu seeds, %" PRIu64 " execs in %" PRId64 " ms, %" PRIu64
+           " exec/s, %zu signatures, %zu inputs kept\n",
+           target->name, seeds, execs, elapsed_ms,
+           elapsed_ms ? execs * 1000 / elapsed_ms : 0, seen_count, pool_size);
+}
+
+void app_main(void)
+{
+    esp_log_level_set("*", ESP_LOG_NONE); // refused inputs log errors
+    rng_state = CONFIG_FUZZ_SEED ? CONFIG_FUZZ_SEED : 1;
+    printf("seed %d, %d s per target\n", CONFIG_FUZZ_SEED,
+           CONFIG_FUZZ_SECONDS);
+    for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+        run_target(&targets[i]);
+    }
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,113 @@
+/*
+ * Low-power bus budget: transactions past max_transactions_per_hour are
+ * refused, time reads fall back to the cache, and the budget comes back
+ * after the hour.
+ */
+
+#include "test_ds1307.h"
+
+#define HOUR_US (3600LL * 1000000)
+
+static ds1307_handle_t budget_init(uint32_t max_transactions_per_hour)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    const ds1307_low_power_config_t low_power = {
+        .max_transactions_per_hour = max_transactions_per_hour,
+        .transaction_charge_nc = 1000,
+        .byte_charge_nc = 10,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_low_power(ds1307_handle, &low_power));
+    test_begin(ds1307_handle);
+    return ds1307_handle;
+}
+
+static void test_budget_enforced(void)
+{
+    ds1307_handle_t ds1307_handle = budget_init(3);
+
+    struct tm tm;
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    }
+    test_expect_stats(ds1307_handle, 3, 0, 3 * 7, 3);
+
+    // over budget: the time comes from the cache, the rest is refused
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    bool halt;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE,
+                      ds1307_get_halt(ds1307_handle, &halt));
+    uint8_t data[2] = {0x12, 0x34};
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE,
+                      ds1307_set_ram(ds1307_handle, 0, data, sizeof(data)));
+    test_expect_stats(ds1307_handle, 3, 0, 3 * 7, 3);
+    ds1307_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_stats(ds1307_handle, &stats));
+    TEST_ASSERT_EQUAL_UINT32(3, stats.budget_denied_count);
+
+    // a new hour, a new budget
+    ds1307_sim_skip(HOUR_US);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_halt(ds1307_handle, &halt));
+    TEST_ASSERT_FALSE(halt);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    TEST_ASSERT_EQUAL(11, tm.tm_hour);
+    test_expect_stats(ds1307_handle, 5, 0, 3 * 7 + 1 + 7, 5);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_budget_cached_time(void)
+{
+    ds1307_handle_t ds1307_handle = budget_init(1);
+
+    struct timeval tv;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_timeval(ds1307_handle, &tv));
+    TEST_ASSERT_EQUAL(TEST_TIME_SECONDS, tv.tv_sec);
+
+    // the cache is advanced with esp_timer, however old it is
+    ds1307_sim_skip(600LL * 1000000);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_timeval(ds1307_handle, &tv));
+    TEST_ASSERT_INT_WITHIN(1, TEST_TIME_SECONDS + 600, tv.tv_sec);
+    test_expect_stats(ds1307_handle, 1, 0, 7, 1);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_budget_no_cache(void)
+{
+    ds1307_handle_t ds1307_handle = budget_init(1);
+
+    bool halt;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_halt(ds1307_handle, &halt));
+    struct tm tm;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE,
+                      ds1307_get_datetime(ds1307_handle, &tm));
+    test_expect_stats(ds1307_handle, 1, 0, 1, 1);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_charge(void)
+{
+    ds1307_handle_t ds1307_handle = budget_init(0);
+
+    uint64_t before, after;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_charge(ds1307_handle, &before));
+    struct tm tm;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_halt(ds1307_handle, true));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_charge(ds1307_handle, &after));
+
+    // every transaction costs 1000 nC, every byte on the wire 10 nC
+    ds1307_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_stats(ds1307_handle, &stats));
+    TEST_ASSERT_EQUAL(1000 * (stats.read_count + stats.write_count) +
+                          10 * (stats.read_bytes + stats.write_bytes),
+                      after - before);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+void test_budget(void)
+{
+    RUN_TEST(test_budget_enforced);
+    RUN_TEST(test_budget_cached_time);
+    RUN_TEST(test_budget_no_cache);
+    RUN_TEST(test_charge);
+}
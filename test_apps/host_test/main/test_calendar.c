@@ -0,0 +1,330 @@
+/*
+ * The chip's calendar against the C library's: every carry in both hour
+ * modes, set and get round trips, and a run over three centuries read
+ * several times a day, including the February 29th the chip makes up in
+ * 1900 and 2100 and its correction.
+ */
+
+#include "test_ds1307.h"
+#include <stdio.h>
+#include <time.h>
+
+#define DAY_SECONDS (24 * 60 * 60)
+#define HOUR_SECONDS (60 * 60)
+#define RUN_STEP_SECONDS (23 * HOUR_SECONDS + 61) // hour, minute, second drift
+#define TRIP_STEP_SECONDS (41 * DAY_SECONDS + 7 * HOUR_SECONDS + 13 * 60 + 17)
+#define TIME_REGS 7
+
+static ds1307_handle_t calendar_init(int century)
+{
+    const ds1307_config_t config = {
+        .ds1307_device.device_address = DS1307_ADDRESS,
+        .ds1307_device.scl_speed_hz = 100000,
+        .century = century,
+    };
+    return test_ds1307_new(&config);
+}
+
+static time_t year_start(int year)
+{
+    struct tm tm = {.tm_year = year - 1900, .tm_mday = 1};
+    return timegm(&tm);
+}
+
+/* Start the simulated clock at 12:00:00 of the given day */
+static void calendar_start(time_t noon)
+{
+    struct tm tm;
+    gmtime_r(&noon, &tm);
+    const uint8_t regs[] = {
+        0x00,
+        0x00,
+        0x12,
+        tm.tm_wday + 1,
+        (tm.tm_mday / 10) << 4 | tm.tm_mday % 10,
+        ((tm.tm_mon + 1) / 10) << 4 | (tm.tm_mon + 1) % 10,
+        (tm.tm_year % 100 / 10) << 4 | tm.tm_year % 10,
+    };
+    ds1307_sim_write(0, regs, sizeof(regs));
+}
+
+static uint8_t bcd(int value)
+{
+    return (value / 10) << 4 | value % 10;
+}
+
+static void expect_tm(const struct tm *want, const struct tm *tm)
+{
+    TEST_ASSERT_EQUAL(want->tm_year, tm->tm_year);
+    TEST_ASSERT_EQUAL(want->tm_mon, tm->tm_mon);
+    TEST_ASSERT_EQUAL(want->tm_mday, tm->tm_mday);
+    TEST_ASSERT_EQUAL(want->tm_wday, tm->tm_wday);
+    TEST_ASSERT_EQUAL(want->tm_hour, tm->tm_hour);
+    TEST_ASSERT_EQUAL(want->tm_min, tm->tm_min);
+    TEST_ASSERT_EQUAL(want->tm_sec, tm->tm_sec);
+}
+
+/* The chip's registers for tm, encoded here rather than by the driver */
+static void expect_regs(const struct tm *tm, bool hour_12)
+{
+    uint8_t hour = bcd(tm->tm_hour);
+    if (hour_12) { // 12 AM is midnight, 12 PM noon
+        hour = 0x40 | (tm->tm_hour >= 12 ? 0x20 : 0) |
+               bcd(tm->tm_hour % 12 ? tm->tm_hour % 12 : 12);
+    }
+    const uint8_t want[TIME_REGS] = {
+        bcd(tm->tm_sec),      bcd(tm->tm_min),     hour,
+        tm->tm_wday + 1,      bcd(tm->tm_mday),    bcd(tm->tm_mon + 1),
+        bcd(tm->tm_year % 100),
+    };
+    uint8_t regs[TIME_REGS];
+    ds1307_sim_read(0, regs, sizeof(regs));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(want, regs, TIME_REGS);
+}
+
+/* Set the clock running a second before t and read it just past the tick */
+static void expect_carry(ds1307_handle_t ds1307_handle, time_t t,
+                         bool hour_12)
+{
+    struct tm tm, want, chip;
+    time_t before = t - 1;
+    gmtime_r(&before, &tm);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_start_datetime(ds1307_handle, &tm));
+    ds1307_sim_skip(1500000);
+
+    gmtime_r(&t, &want);
+    chip = want;
+    if (want.tm_mon == 2 && want.tm_mday == 1 && want.tm_year % 100 == 0 &&
+        (want.tm_year + 1900) % 400 != 0) {
+        chip.tm_mon = 1; // the chip's phantom leap day
+        chip.tm_mday = 29;
+    }
+    expect_regs(&chip, hour_12);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    expect_tm(&want, &tm);
+}
+
+static void carries(bool hour_12)
+{
+    static const int years[] = {1900, 2000, 2023, 2024, 2100};
+    for (size_t i = 0; i < sizeof(years) / sizeof(years[0]); i++) {
+        ds1307_handle_t ds1307_handle = calendar_init(years[i] / 100 + 1);
+        TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_12_hour(ds1307_handle, hour_12));
+        time_t day = year_start(years[i]) + 134 * DAY_SECONDS; // mid May
+
+        // every hour, midnight and noon among them
+        for (int hour = 0; hour < 24; hour++) {
+            expect_carry(ds1307_handle, day + hour * HOUR_SECONDS, hour_12);
+        }
+        // a minute and a second that carry no further
+        expect_carry(ds1307_handle, day + 10 * HOUR_SECONDS + 30 * 60,
+                     hour_12);
+        expect_carry(ds1307_handle, day + 10 * HOUR_SECONDS + 30 * 60 + 15,
+                     hour_12);
+        // every month end, the year end included
+        for (int mon = 1; mon <= 12; mon++) {
+            struct tm first = {
+                .tm_year = years[i] - 1900, .tm_mon = mon, .tm_mday = 1};
+            expect_carry(ds1307_handle, timegm(&first), hour_12);
+        }
+        TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+    }
+}
+
+static void test_carries_24_hour(void)
+{
+    carries(false);
+}
+
+static void test_carries_12_hour(void)
+{
+    carries(true);
+}
+
+/*
+ * set_datetime, get_datetime, set_timeval and get_timeval across a century
+ * on a running clock: writing the seconds restarts the chip's second, so
+ * what is read back right away is what was written.
+ */
+static void round_trips(int century, bool hour_12)
+{
+    ds1307_handle_t ds1307_handle = calendar_init(century);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_12_hour(ds1307_handle, hour_12));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_halt(ds1307_handle, false));
+    time_t end = year_start((century - 1) * 100 + 100);
+    for (time_t t = year_start((century - 1) * 100); t < end;
+         t += TRIP_STEP_SECONDS) {
+        struct tm want, tm;
+        gmtime_r(&t, &want);
+        TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_datetime(ds1307_handle, &want));
+        expect_regs(&want, hour_12);
+        TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+        expect_tm(&want, &tm);
+
+        struct timeval tv = {.tv_sec = t + 1};
+        TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_timeval(ds1307_handle, &tv));
+        TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_timeval(ds1307_handle, &tv));
+        TEST_ASSERT_EQUAL(t + 1, tv.tv_sec);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_round_trips(void)
+{
+    for (int century = 20; century <= 22; century++) {
+        round_trips(century, false);
+        round_trips(century, true);
+    }
+}
+
+/* Read the running clock; it must show a second within [first, last] */
+static void expect_running(ds1307_handle_t ds1307_handle, time_t first,
+                           time_t last)
+{
+    struct tm tm, want;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    struct tm copy = tm;
+    time_t t = timegm(&copy);
+    TEST_ASSERT_TRUE(t >= first && t <= last);
+    gmtime_r(&t, &want);
+    expect_tm(&want, &tm);
+}
+
+/*
+ * Run the chip through a century, reading it every 23:01:01 so the reads
+ * land on every hour, minute and second and on every day, which is what
+ * ds1307_fix_leap_day needs. Returns simulated seconds per wall second.
+ */
+static double run_century(int century, bool hour_12)
+{
+    ds1307_handle_t ds1307_handle = calendar_init(century);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_12_hour(ds1307_handle, hour_12));
+    time_t start = year_start((century - 1) * 100);
+    time_t end = year_start((century - 1) * 100 + 100);
+    struct tm tm;
+    gmtime_r(&start, &tm);
+
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    int64_t write_first = ds1307_sim_now();
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_start_datetime(ds1307_handle, &tm));
+    int64_t write_last = ds1307_sim_now();
+    for (;;) {
+        int64_t read_first = ds1307_sim_now();
+        time_t first = start + (read_first - write_last) / 1000000;
+        if (first + 2 >= end) {
+            break; // the chip's year 99 goes on to 00 of the same century
+        }
+        expect_running(ds1307_handle, first, first + 1 +
+                       (write_last - write_first) / 1000000);
+        bool fixed;
+        TEST_ASSERT_EQUAL(ESP_OK, ds1307_fix_leap_day(ds1307_handle, &fixed));
+        ds1307_sim_skip((int64_t)RUN_STEP_SECONDS * 1000000);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+    double wall = (wall_end.tv_sec - wall_start.tv_sec) +
+                  (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+    return (double)(end - start) / wall;
+}
+
+static void test_centuries(void)
+{
+    for (int century = 20; century <= 22; century++) {
+        for (int hour_12 = 0; hour_12 <= 1; hour_12++) {
+            double rate = run_century(century, hour_12);
+            printf("%d-%d, %s hour: %.3g simulated seconds per wall second\n",
+                   (century - 1) * 100, (century - 1) * 100 + 99,
+                   hour_12 ? "12" : "24", rate);
+        }
+    }
+}
+
+static void test_leap_day_fix(void)
+{
+    ds1307_handle_t ds1307_handle = calendar_init(22);
+    static const uint8_t regs[] = {0x00, 0x00, 0x12, 0x02, 0x29, 0x02, 0x00};
+    ds1307_sim_write(0, regs, sizeof(regs)); // 2100-02-29 12:00:00, Monday
+
+    // reported as the real date, the chip left alone
+    test_begin(ds1307_handle);
+    struct tm tm;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    TEST_ASSERT_EQUAL(2, tm.tm_mon);
+    TEST_ASSERT_EQUAL(1, tm.tm_mday);
+    TEST_ASSERT_EQUAL(1, tm.tm_wday);
+    test_expect_stats(ds1307_handle, 1, 0, 7, 1);
+
+    bool fixed;
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_fix_leap_day(ds1307_handle, &fixed));
+    TEST_ASSERT_TRUE(fixed);
+    test_expect_xfer(1, false, 0x04, 2);
+    test_expect_payload(1, (const uint8_t[]){0x01, 0x03}, 2);
+
+    // nothing left to fix
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_fix_leap_day(ds1307_handle, &fixed));
+    TEST_ASSERT_FALSE(fixed);
+    test_expect_stats(ds1307_handle, 1, 0, 7, 1);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_leap_day_before_midnight(void)
+{
+    ds1307_handle_t ds1307_handle = calendar_init(22);
+    static const uint8_t regs[] = {0x59, 0x59, 0x23, 0x02, 0x29, 0x02, 0x00};
+    ds1307_sim_write(0, regs, sizeof(regs)); // 2100-02-29 23:59:59, Monday
+
+    struct tm tm;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    TEST_ASSERT_EQUAL(2, tm.tm_mon);
+    TEST_ASSERT_EQUAL(1, tm.tm_mday);
+    TEST_ASSERT_EQUAL(23, tm.tm_hour);
+
+    // the chip rolls over to its 03-01 first, which is really 03-02
+    bool fixed;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_fix_leap_day(ds1307_handle, &fixed));
+    TEST_ASSERT_TRUE(fixed);
+    uint8_t date[2];
+    ds1307_sim_read(4, date, sizeof(date));
+    TEST_ASSERT_EQUAL_HEX8(0x02, date[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x03, date[1]);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    TEST_ASSERT_EQUAL(2100 - 1900, tm.tm_year);
+    TEST_ASSERT_EQUAL(2, tm.tm_mon);
+    TEST_ASSERT_EQUAL(2, tm.tm_mday);
+    TEST_ASSERT_EQUAL(2, tm.tm_wday);
+    TEST_ASSERT_EQUAL(0, tm.tm_hour);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_leap_day_unread(void)
+{
+    ds1307_handle_t ds1307_handle = calendar_init(22);
+    calendar_start(4107499200); // 2100-02-28 12:00:00
+
+    // nothing reads on the phantom 02-29: the chip is a day behind for good
+    ds1307_sim_skip(2LL * DAY_SECONDS * 1000000);
+    struct tm tm;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    TEST_ASSERT_EQUAL(2, tm.tm_mon);
+    TEST_ASSERT_EQUAL(1, tm.tm_mday); // really 03-02
+    TEST_ASSERT_EQUAL(2, tm.tm_wday); // the day register counted right
+    ds1307_sim_skip((int64_t)DAY_SECONDS * 1000000);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    TEST_ASSERT_EQUAL(2, tm.tm_mon);
+    TEST_ASSERT_EQUAL(2, tm.tm_mday);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+void test_calendar(void)
+{
+    RUN_TEST(test_carries_24_hour);
+    RUN_TEST(test_carries_12_hour);
+    RUN_TEST(test_round_trips);
+    RUN_TEST(test_centuries);
+    RUN_TEST(test_leap_day_fix);
+    RUN_TEST(test_leap_day_before_midnight);
+    RUN_TEST(test_leap_day_unread);
+}
@@ -0,0 +1,159 @@
+/*
+ * Last-known-time checkpoint in the module EEPROM: a halted clock is
+ * restarted from it, a halted clock is never saved, periodic saves stop
+ * before ds1307_checkpoint_del frees the checkpoint, and slots and period
+ * are checked against the EEPROM size and the FreeRTOS delay range.
+ */
+
+#include "ds1307_checkpoint.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "test_ds1307.h"
+
+static ds1307_checkpoint_handle_t checkpoint_new(ds1307_handle_t ds1307_handle,
+                                                 uint32_t period_s)
+{
+    const ds1307_checkpoint_config_t config = {
+        .eeprom_device.device_address = DS1307_EEPROM_ADDRESS,
+        .eeprom_device.scl_speed_hz = 100000,
+        .period_s = period_s,
+    };
+    const i2c_master_bus_config_t bus_config = {
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .i2c_port = -1,
+    };
+    i2c_master_bus_handle_t bus_handle; // the simulated bus, shared
+    TEST_ASSERT_EQUAL(ESP_OK, i2c_new_master_bus(&bus_config, &bus_handle));
+    ds1307_checkpoint_handle_t checkpoint;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_checkpoint_new(bus_handle, ds1307_handle,
+                                                    &config, &checkpoint));
+    return checkpoint;
+}
+
+/* Seconds saved in a slot, little endian after the sequence number */
+static int64_t slot_seconds(int slot)
+{
+    const uint8_t *data =
+        ds1307_sim_eeprom() + slot * DS1307_CHECKPOINT_SLOT_SIZE + 2;
+    int64_t seconds = 0;
+    for (int i = 4; i >= 0; i--) {
+        seconds = seconds << 8 | data[i];
+    }
+    return seconds;
+}
+
+static void test_checkpoint_restore(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    ds1307_checkpoint_handle_t checkpoint = checkpoint_new(ds1307_handle, 0);
+    bool restored, halt;
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_checkpoint_restored(checkpoint, &restored));
+    TEST_ASSERT_FALSE(restored);
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_checkpoint_save(checkpoint));
+    test_expect_xfer(0, true, 0x00, 7);
+    // one page write of slot 0, holding the time just read
+    const ds1307_sim_xfer_t *xfer = ds1307_sim_log(1);
+    TEST_ASSERT_EQUAL_HEX16(DS1307_EEPROM_ADDRESS, xfer->address);
+    TEST_ASSERT_EQUAL_HEX16(0x0000, xfer->reg);
+    test_expect_payload(1, ds1307_sim_eeprom(), DS1307_CHECKPOINT_SLOT_SIZE);
+    TEST_ASSERT_INT_WITHIN(1, TEST_TIME_SECONDS, slot_seconds(0));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_checkpoint_del(checkpoint));
+
+    // the backup battery dies: the clock comes back halted
+    static const uint8_t halted = 0x80;
+    ds1307_sim_write(0, &halted, 1);
+    vTaskDelay(pdMS_TO_TICKS(10)); // the EEPROM write cycle
+    checkpoint = checkpoint_new(ds1307_handle, 0);
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_checkpoint_restored(checkpoint, &restored));
+    TEST_ASSERT_TRUE(restored);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_halt(ds1307_handle, &halt));
+    TEST_ASSERT_FALSE(halt);
+    struct timeval tv;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_timeval(ds1307_handle, &tv));
+    TEST_ASSERT_INT_WITHIN(2, TEST_TIME_SECONDS, tv.tv_sec);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_checkpoint_del(checkpoint));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_checkpoint_save_halted(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    ds1307_checkpoint_handle_t checkpoint = checkpoint_new(ds1307_handle, 0);
+
+    // the halt flag comes with the time, in one read, and nothing is written
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE,
+                      ds1307_checkpoint_save(checkpoint));
+    test_expect_stats(ds1307_handle, 1, 0, 7, 1);
+    test_expect_xfer(0, true, 0x00, 7);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_checkpoint_del(checkpoint));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_checkpoint_periodic(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    ds1307_checkpoint_handle_t checkpoint = checkpoint_new(ds1307_handle, 1);
+
+    vTaskDelay(pdMS_TO_TICKS(1500));
+    // the save task has exited once this returns
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_checkpoint_del(checkpoint));
+    TEST_ASSERT_INT_WITHIN(2, TEST_TIME_SECONDS + 1, slot_seconds(0));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_checkpoint_limits(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    const i2c_master_bus_config_t bus_config = {
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .i2c_port = -1,
+    };
+    i2c_master_bus_handle_t bus_handle;
+    TEST_ASSERT_EQUAL(ESP_OK, i2c_new_master_bus(&bus_config, &bus_handle));
+    ds1307_checkpoint_config_t config = {
+        .eeprom_device.device_address = DS1307_EEPROM_ADDRESS,
+        .eeprom_device.scl_speed_hz = 100000,
+        .eeprom_offset = DS1307_EEPROM_SIZE - 16 * DS1307_CHECKPOINT_SLOT_SIZE,
+    };
+    ds1307_checkpoint_handle_t checkpoint;
+
+    // the default 16 slots fill the EEPROM up to its last byte
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_checkpoint_new(bus_handle, ds1307_handle,
+                                                    &config, &checkpoint));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_checkpoint_del(checkpoint));
+    config.slot_count = 17;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                      ds1307_checkpoint_new(bus_handle, ds1307_handle,
+                                            &config, &checkpoint));
+    config.slot_count = 0;
+    config.eeprom_offset += DS1307_CHECKPOINT_SLOT_SIZE;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                      ds1307_checkpoint_new(bus_handle, ds1307_handle,
+                                            &config, &checkpoint));
+
+    // a period beyond a FreeRTOS delay, instead of a wrapped short one
+    config.eeprom_offset = 0;
+    config.period_s = UINT32_MAX / 1000 * 1000;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                      ds1307_checkpoint_new(bus_handle, ds1307_handle,
+                                            &config, &checkpoint));
+    config.period_s = (portMAX_DELAY - 1) / configTICK_RATE_HZ;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_checkpoint_new(bus_handle, ds1307_handle,
+                                                    &config, &checkpoint));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_checkpoint_del(checkpoint));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+void test_checkpoint(void)
+{
+    RUN_TEST(test_checkpoint_restore);
+    RUN_TEST(test_checkpoint_save_halted);
+    RUN_TEST(test_checkpoint_periodic);
+    RUN_TEST(test_checkpoint_limits);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "ds1307.h"
+#include "ds1307_sim.h"
+#include "unity.h"
+
+/* 2024-05-15 10:20:30, a Wednesday, in register order */
+#define TEST_TIME_REGS {0x30, 0x20, 0x10, 0x04, 0x15, 0x05, 0x24}
+#define TEST_TIME_SECONDS (1715768430)
+
+/**
+ * @brief Create a handle on the simulated bus
+ */
+ds1307_handle_t test_ds1307_new(const ds1307_config_t *config);
+
+/**
+ * @brief Create a handle on the simulated bus, century 21
+ */
+ds1307_handle_t test_ds1307_init(bool multi_master);
+
+/**
+ * @brief Start the simulated clock at TEST_TIME_REGS
+ */
+void test_start_clock(void);
+
+/**
+ * @brief Zero the driver statistics and clear the sim transaction log
+ */
+void test_begin(ds1307_handle_t ds1307_handle);
+
+/**
+ * @brief Assert the driver statistics since test_begin
+ */
+void test_expect_stats(ds1307_handle_t ds1307_handle, uint32_t read_count,
+                       uint32_t write_count, uint32_t read_bytes,
+                       uint32_t write_bytes);
+
+/**
+ * @brief Assert one logged DS1307 transaction
+ *
+ * @param[in] index Position in the log since test_begin
+ * @param[in] read Register read, else register write
+ * @param[in] reg Register pointer
+ * @param[in] size Bytes read, or written after the pointer
+ */
+void test_expect_xfer(size_t index, bool read, uint8_t reg, size_t size);
+
+/**
+ * @brief Assert the data bytes of one logged transaction
+ *
+ * @param[in] index Position in the log since test_begin
+ * @param[in] data Bytes written after the pointer, or read
+ * @param[in] size Number of bytes, at most DS1307_SIM_DATA_MAX
+ */
+void test_expect_payload(size_t index, const uint8_t *data, size_t size);
+
+/* RUN_TEST lists of the test files */
+void test_transactions(void);
+void test_budget(void);
+void test_calendar(void);
+void test_checkpoint(void);
+void test_ram_region(void);
+void test_rmw(void);
+void test_time_source(void);
+void test_ds1307ctl(void);
@@ -0,0 +1,239 @@
+/*
+ * ds1307ctl commands on the simulated chip: the JSON each one prints, what
+ * it leaves in the registers, and a phase-aligned set that a fresh handle
+ * then measures with sync to within a millisecond or so.
+ */
+
+#include "ds1307ctl.h"
+#include "test_ds1307.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static char s_out[1024];
+
+/* Run a ds1307ctl command line, its output left in s_out */
+static int ctl(ds1307_handle_t ds1307_handle, bool json, const char *line)
+{
+    char buf[256], *argv[16], *save;
+    int argc = 0;
+    TEST_ASSERT_LESS_THAN(sizeof(buf), strlen(line));
+    strcpy(buf, line);
+    for (char *arg = strtok_r(buf, " ", &save); arg && argc < 16;
+         arg = strtok_r(NULL, " ", &save)) {
+        argv[argc++] = arg;
+    }
+    FILE *out = fmemopen(s_out, sizeof(s_out), "w");
+    TEST_ASSERT_NOT_NULL(out);
+    int status = ds1307ctl_run(ds1307_handle, json, argc, argv, out);
+    fclose(out);
+    return status;
+}
+
+static void test_ctl_get(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK, ctl(ds1307_handle, true, "get"));
+    TEST_ASSERT_EQUAL_STRING("{\"time\": \"2000-01-01T00:00:00Z\", "
+                             "\"seconds\": 946684800, \"weekday\": 0, "
+                             "\"halt\": true}\n",
+                             s_out);
+    test_start_clock();
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK, ctl(ds1307_handle, false, "get"));
+    TEST_ASSERT_EQUAL_STRING("2024-05-15 10:20:30 weekday 3\n", s_out);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_ctl_set(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK,
+                      ctl(ds1307_handle, true, "set 2024-02-29 23:59:59"));
+    TEST_ASSERT_EQUAL_STRING("{\"time\": \"2024-02-29T23:59:59Z\", "
+                             "\"seconds\": 1709251199}\n",
+                             s_out);
+    // started, a Thursday
+    static const uint8_t expected[] = {0x59, 0x59, 0x23, 0x05,
+                                       0x29, 0x02, 0x24};
+    uint8_t regs[sizeof(expected)];
+    ds1307_sim_read(0, regs, sizeof(regs));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, regs, sizeof(expected));
+
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_ERROR,
+                      ctl(ds1307_handle, true, "set 2023-02-29 00:00:00"));
+    TEST_ASSERT_EQUAL_STRING("{\"error\": \"ESP_ERR_INVALID_ARG\"}\n", s_out);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_USAGE,
+                      ctl(ds1307_handle, true, "set 2024-02-29 23:59"));
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_USAGE,
+                      ctl(ds1307_handle, true, "set 2024-02-29x 23:59:59"));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_ctl_set_aligned_sync(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    long long seconds, offset_us;
+
+    // the halted chip starts, ticking in step with the system clock
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK, ctl(ds1307_handle, true, "set"));
+    TEST_ASSERT_EQUAL(2, sscanf(s_out, "{\"time\": \"%*[^\"]\", \"seconds\": "
+                                       "%lld, \"offset_us\": %lld}",
+                                &seconds, &offset_us));
+    TEST_ASSERT_INT_WITHIN(2000, 0, offset_us);
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    TEST_ASSERT_INT_WITHIN(1, now.tv_sec, seconds);
+    uint8_t sec;
+    ds1307_sim_read(0, &sec, 1);
+    TEST_ASSERT_BITS_LOW(0x80, sec);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+
+    // a fresh handle knows no phase: sync finds the tick by polling
+    ds1307_handle = test_ds1307_init(false);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK,
+                      ctl(ds1307_handle, true, "sync --dry-run"));
+    TEST_ASSERT_EQUAL(2, sscanf(s_out, "{\"seconds\": %lld, \"offset_us\": "
+                                       "%lld,",
+                                &seconds, &offset_us));
+    TEST_ASSERT_NOT_NULL(strstr(s_out, ", \"set\": false}\n"));
+    TEST_ASSERT_INT_WITHIN(2000, 0, offset_us);
+    gettimeofday(&now, NULL);
+    TEST_ASSERT_INT_WITHIN(1, now.tv_sec, seconds);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_USAGE,
+                      ctl(ds1307_handle, true, "sync --now"));
+
+    // a halted clock has no tick to find
+    static const uint8_t halted = 0x80;
+    ds1307_sim_write(0, &halted, 1);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_ERROR,
+                      ctl(ds1307_handle, true, "sync --dry-run"));
+    TEST_ASSERT_EQUAL_STRING("{\"error\": \"ESP_ERR_INVALID_STATE\"}\n",
+                             s_out);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_ctl_status(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK, ctl(ds1307_handle, true, "status"));
+    TEST_ASSERT_EQUAL_STRING("{\"halt\": true, \"hour_12\": false, "
+                             "\"square_wave\": false, \"rate_hz\": 32768, "
+                             "\"output\": false}\n",
+                             s_out);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_ctl_regs(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK, ctl(ds1307_handle, true, "regs"));
+    char expected[160] = "{\"regs\": \"8000000101010003";
+    for (int i = 8; i < DS1307_REG_IMAGE_SIZE; i++) {
+        strcat(expected, "00");
+    }
+    strcat(expected, "\"}\n");
+    TEST_ASSERT_EQUAL_STRING(expected, s_out);
+
+    char path[] = "/tmp/ds1307ctl_XXXXXX", line[64];
+    int fd = mkstemp(path);
+    TEST_ASSERT_NOT_EQUAL(-1, fd);
+    close(fd);
+    snprintf(line, sizeof(line), "regs save %s", path);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK, ctl(ds1307_handle, true, line));
+    TEST_ASSERT_EQUAL_STRING(expected, s_out);
+    static const uint8_t changed[] = {0xab, 0xcd};
+    ds1307_sim_write(0x08, changed, 1);
+    ds1307_sim_write(0x3f, changed + 1, 1);
+    snprintf(line, sizeof(line), "regs diff %s", path);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK, ctl(ds1307_handle, true, line));
+    TEST_ASSERT_EQUAL_STRING("{\"diff\": [{\"reg\": 8, \"old\": 0, "
+                             "\"new\": 171}, {\"reg\": 63, \"old\": 0, "
+                             "\"new\": 205}]}\n",
+                             s_out);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK, ctl(ds1307_handle, false, line));
+    TEST_ASSERT_EQUAL_STRING("0x08: 00 -> ab\n0x3f: 00 -> cd\n", s_out);
+    unlink(path);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_ERROR, ctl(ds1307_handle, false, line));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_ctl_ram(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK,
+                      ctl(ds1307_handle, true, "ram write 54 de ad"));
+    TEST_ASSERT_EQUAL_STRING("{\"offset\": 54, \"size\": 2}\n", s_out);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK,
+                      ctl(ds1307_handle, true, "ram read 53"));
+    TEST_ASSERT_EQUAL_STRING("{\"offset\": 53, \"data\": \"00dead\"}\n",
+                             s_out);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK,
+                      ctl(ds1307_handle, false, "ram read 0x30 8"));
+    TEST_ASSERT_EQUAL_STRING("0x30: 00 00 00 00 00 00 de ad\n", s_out);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_ERROR,
+                      ctl(ds1307_handle, true, "ram write 55 01 02"));
+    TEST_ASSERT_EQUAL_STRING("{\"error\": \"ESP_ERR_INVALID_ARG\"}\n", s_out);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_USAGE,
+                      ctl(ds1307_handle, true, "ram write 0 100"));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+
+    // the generation byte is left out of a whole RAM read
+    ds1307_handle = test_ds1307_init(true);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK, ctl(ds1307_handle, true, "ram read"));
+    TEST_ASSERT_EQUAL(0, strncmp(s_out, "{\"offset\": 1, \"data\": \"", 23));
+    TEST_ASSERT_EQUAL(23 + 2 * (DS1307_RAM_SIZE - 1) + 3, strlen(s_out));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_ctl_bench(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_OK,
+                      ctl(ds1307_handle, true, "bench 20"));
+    float min_us, mean_us, p50_us, p99_us, max_us, transactions;
+    const char *entry = strstr(s_out, "\"ds1307_get_datetime\": ");
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL(6, sscanf(entry, "\"ds1307_get_datetime\": "
+                                       "{\"min_us\": %f, \"mean_us\": %f, "
+                                       "\"p50_us\": %f, \"p99_us\": %f, "
+                                       "\"max_us\": %f, \"transactions\": %f}",
+                                &min_us, &mean_us, &p50_us, &p99_us, &max_us,
+                                &transactions));
+    TEST_ASSERT_TRUE(min_us <= p50_us && p50_us <= p99_us &&
+                     p99_us <= max_us && min_us <= mean_us &&
+                     mean_us <= max_us);
+    TEST_ASSERT_EQUAL_FLOAT(1.0f, transactions);
+    entry = strstr(s_out, "\"ds1307_get_registers\": ");
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL(0, strncmp(s_out, "{\"iterations\": 20, ", 19));
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_USAGE,
+                      ctl(ds1307_handle, true, "bench 0"));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_ctl_errors(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    ds1307_sim_fail_next(ESP_ERR_TIMEOUT);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_ERROR, ctl(ds1307_handle, true, "get"));
+    TEST_ASSERT_EQUAL_STRING("{\"error\": \"ESP_ERR_TIMEOUT\"}\n", s_out);
+    ds1307_sim_fail_next(ESP_ERR_TIMEOUT);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_ERROR, ctl(ds1307_handle, false, "regs"));
+    TEST_ASSERT_EQUAL_STRING("error: ESP_ERR_TIMEOUT\n", s_out);
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_USAGE, ctl(ds1307_handle, true, "time"));
+    TEST_ASSERT_EQUAL(DS1307CTL_EXIT_USAGE, ctl(ds1307_handle, true, ""));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+void test_ds1307ctl(void)
+{
+    RUN_TEST(test_ctl_get);
+    RUN_TEST(test_ctl_set);
+    RUN_TEST(test_ctl_set_aligned_sync);
+    RUN_TEST(test_ctl_status);
+    RUN_TEST(test_ctl_regs);
+    RUN_TEST(test_ctl_ram);
+    RUN_TEST(test_ctl_bench);
+    RUN_TEST(test_ctl_errors);
+}
@@ -0,0 +1,101 @@
+#include "Mockesp_timer.h"
+#include "Mocki2c_master.h"
+#include "test_ds1307.h"
+#include <stdlib.h>
+
+void setUp(void)
+{
+    Mocki2c_master_Init();
+    Mockesp_timer_Init();
+    ds1307_sim_attach();
+}
+
+void tearDown(void)
+{
+    Mocki2c_master_Verify();
+    Mockesp_timer_Verify();
+    Mocki2c_master_Destroy();
+    Mockesp_timer_Destroy();
+}
+
+ds1307_handle_t test_ds1307_new(const ds1307_config_t *config)
+{
+    i2c_master_bus_config_t bus_config = {
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .i2c_port = -1,
+    };
+    i2c_master_bus_handle_t bus_handle;
+    TEST_ASSERT_EQUAL(ESP_OK, i2c_new_master_bus(&bus_config, &bus_handle));
+    ds1307_handle_t ds1307_handle;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_init(bus_handle, config, &ds1307_handle));
+    return ds1307_handle;
+}
+
+ds1307_handle_t test_ds1307_init(bool multi_master)
+{
+    const ds1307_config_t config = {
+        .ds1307_device.device_address = DS1307_ADDRESS,
+        .ds1307_device.scl_speed_hz = 100000,
+        .multi_master = multi_master,
+    };
+    return test_ds1307_new(&config);
+}
+
+void test_start_clock(void)
+{
+    static const uint8_t time[] = TEST_TIME_REGS;
+    ds1307_sim_write(0, time, sizeof(time));
+}
+
+void test_begin(ds1307_handle_t ds1307_handle)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_reset_stats(ds1307_handle));
+    ds1307_sim_log_clear();
+}
+
+void test_expect_stats(ds1307_handle_t ds1307_handle, uint32_t read_count,
+                       uint32_t write_count, uint32_t read_bytes,
+                       uint32_t write_bytes)
+{
+    ds1307_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_stats(ds1307_handle, &stats));
+    TEST_ASSERT_EQUAL_UINT32(read_count, stats.read_count);
+    TEST_ASSERT_EQUAL_UINT32(write_count, stats.write_count);
+    TEST_ASSERT_EQUAL_UINT32(read_bytes, stats.read_bytes);
+    TEST_ASSERT_EQUAL_UINT32(write_bytes, stats.write_bytes);
+    TEST_ASSERT_EQUAL(read_count + write_count, ds1307_sim_log_count());
+}
+
+void test_expect_xfer(size_t index, bool read, uint8_t reg, size_t size)
+{
+    const ds1307_sim_xfer_t *xfer = ds1307_sim_log(index);
+    TEST_ASSERT_NOT_NULL(xfer);
+    TEST_ASSERT_EQUAL_HEX16(DS1307_ADDRESS, xfer->address);
+    TEST_ASSERT_EQUAL(read, xfer->read);
+    TEST_ASSERT_EQUAL_HEX8(reg, xfer->reg);
+    TEST_ASSERT_EQUAL(size, xfer->size);
+    TEST_ASSERT_EQUAL(ESP_OK, xfer->ret);
+}
+
+void test_expect_payload(size_t index, const uint8_t *data, size_t size)
+{
+    const ds1307_sim_xfer_t *xfer = ds1307_sim_log(index);
+    TEST_ASSERT_NOT_NULL(xfer);
+    TEST_ASSERT_EQUAL(size, xfer->size);
+    TEST_ASSERT_TRUE(size <= DS1307_SIM_DATA_MAX);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data, xfer->data, size);
+}
+
+void app_main(void)
+{
+    UNITY_BEGIN();
+    test_transactions();
+    test_budget();
+    test_calendar();
+    test_checkpoint();
+    test_ram_region();
+    test_rmw();
+    test_time_source();
+    test_ds1307ctl();
+    exit(UNITY_END());
+}
@@ -0,0 +1,214 @@
+/*
+ * Shared RAM regions: flush merging, and a contention benchmark of region
+ * owners against the same writers calling ds1307_set_ram directly.
+ */
+
+#include "ds1307_ram_region.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "test_ds1307.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define REGION_SIZE 8
+#define WRITERS 4
+#define RUN_MS 500
+#define FLUSH_MS 10
+
+static void test_flush_merges(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    ds1307_ram_pool_handle_t pool;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_ram_pool_new(ds1307_handle, 0, 0, &pool));
+    ds1307_ram_region_handle_t regions[WRITERS];
+    for (int i = 0; i < WRITERS; i++) {
+        char name[DS1307_RAM_REGION_NAME_MAX];
+        snprintf(name, sizeof(name), "owner%u", (uint8_t)i);
+        TEST_ASSERT_EQUAL(ESP_OK, ds1307_ram_region_alloc(pool, name,
+                                                          REGION_SIZE,
+                                                          &regions[i]));
+    }
+
+    // staging is bus free; neighbours go out in one burst
+    test_begin(ds1307_handle);
+    uint8_t data[REGION_SIZE];
+    for (int i = 0; i < WRITERS; i++) {
+        memset(data, i + 1, sizeof(data));
+        TEST_ASSERT_EQUAL(ESP_OK, ds1307_ram_region_write(regions[i], 0, data,
+                                                          sizeof(data)));
+    }
+    test_expect_stats(ds1307_handle, 0, 0, 0, 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_ram_pool_flush(pool));
+    test_expect_xfer(0, false, 0x08, WRITERS * REGION_SIZE);
+    test_expect_stats(ds1307_handle, 0, 1, 0, 1 + WRITERS * REGION_SIZE);
+    uint8_t burst[WRITERS * REGION_SIZE];
+    for (int i = 0; i < WRITERS; i++) {
+        memset(burst + i * REGION_SIZE, i + 1, REGION_SIZE);
+    }
+    test_expect_payload(0, burst, sizeof(burst));
+
+    // a clean region in between is too big a gap to rewrite
+    test_begin(ds1307_handle);
+    memset(data, 0x55, sizeof(data));
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_ram_region_write(regions[0], 0, data, 1));
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_ram_region_write(regions[2], 0, data, 1));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_ram_pool_flush(pool));
+    test_expect_xfer(0, false, 0x08, REGION_SIZE);
+    test_expect_xfer(1, false, 0x08 + 2 * REGION_SIZE, REGION_SIZE);
+    test_expect_stats(ds1307_handle, 0, 2, 0, 2 * (1 + REGION_SIZE));
+    burst[0] = 0x55; // whole regions go out, the rest as staged before
+    test_expect_payload(0, burst, REGION_SIZE);
+    burst[2 * REGION_SIZE] = 0x55;
+    test_expect_payload(1, burst + 2 * REGION_SIZE, REGION_SIZE);
+
+    uint8_t ram[WRITERS * REGION_SIZE];
+    ds1307_sim_read(0x08, ram, sizeof(ram));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(burst, ram, sizeof(ram));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_ram_pool_del(pool));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+typedef struct {
+    ds1307_handle_t ds1307_handle;
+    ds1307_ram_pool_handle_t pool; /*!< NULL to call ds1307_set_ram */
+    ds1307_ram_region_handle_t regions[WRITERS];
+    bool stop;
+    uint32_t running;
+    uint32_t writes[WRITERS];
+    uint8_t last[WRITERS];
+    uint32_t errors;
+} contention_t;
+
+typedef struct {
+    contention_t *run;
+    int index;
+} writer_arg_t;
+
+static void writer_task(void *arg)
+{
+    contention_t *run = ((writer_arg_t *)arg)->run;
+    int i = ((writer_arg_t *)arg)->index;
+    uint8_t pattern = 0, out[REGION_SIZE], in[REGION_SIZE];
+    while (!__atomic_load_n(&run->stop, __ATOMIC_ACQUIRE)) {
+        memset(out, ++pattern, sizeof(out));
+        esp_err_t ret;
+        if (run->pool) {
+            ret = ds1307_ram_region_write(run->regions[i], 0, out,
+                                          sizeof(out));
+            if (ret == ESP_OK) {
+                ret = ds1307_ram_region_read(run->regions[i], 0, in,
+                                             sizeof(in));
+            }
+        } else {
+            ret = ds1307_set_ram(run->ds1307_handle, i * REGION_SIZE, out,
+                                 sizeof(out));
+            if (ret == ESP_OK) {
+                ret = ds1307_get_ram(run->ds1307_handle, i * REGION_SIZE, in,
+                                     sizeof(in));
+            }
+        }
+        if (ret != ESP_OK || memcmp(out, in, sizeof(out)) != 0) {
+            __atomic_fetch_add(&run->errors, 1, __ATOMIC_RELAXED);
+        }
+        run->last[i] = pattern;
+        run->writes[i]++;
+        vTaskDelay(1); // owner work between writes
+    }
+    __atomic_fetch_sub(&run->running, 1, __ATOMIC_RELEASE);
+    vTaskDelete(NULL);
+}
+
+/* Run the writers for RUN_MS, flushing the pool if there is one */
+static void contend(contention_t *run, ds1307_stats_t *stats)
+{
+    writer_arg_t args[WRITERS];
+    ds1307_sim_set_bus_speed(100000);
+    test_begin(run->ds1307_handle);
+    run->running = WRITERS;
+    for (int i = 0; i < WRITERS; i++) {
+        args[i] = (writer_arg_t){.run = run, .index = i};
+        TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(writer_task, "writer", 4096,
+                                              &args[i], 5, NULL));
+    }
+    for (int ms = 0; ms < RUN_MS; ms += FLUSH_MS) {
+        vTaskDelay(pdMS_TO_TICKS(FLUSH_MS));
+        if (run->pool) {
+            TEST_ASSERT_EQUAL(ESP_OK, ds1307_ram_pool_flush(run->pool));
+        }
+    }
+    __atomic_store_n(&run->stop, true, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&run->running, __ATOMIC_ACQUIRE)) {
+        vTaskDelay(1);
+    }
+    ds1307_sim_set_bus_speed(0);
+    if (run->pool) {
+        TEST_ASSERT_EQUAL(ESP_OK, ds1307_ram_pool_flush(run->pool));
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_stats(run->ds1307_handle, stats));
+    TEST_ASSERT_EQUAL(0, run->errors);
+    for (int i = 0; i < WRITERS; i++) { // the chip holds every last write
+        uint8_t ram[REGION_SIZE];
+        ds1307_sim_read(0x08 + i * REGION_SIZE, ram, sizeof(ram));
+        TEST_ASSERT_EQUAL_HEX8(run->last[i], ram[0]);
+        TEST_ASSERT_EQUAL_HEX8(run->last[i], ram[REGION_SIZE - 1]);
+    }
+}
+
+static uint32_t total_writes(const contention_t *run)
+{
+    uint32_t writes = 0;
+    for (int i = 0; i < WRITERS; i++) {
+        writes += run->writes[i];
+    }
+    return writes;
+}
+
+static void test_contention(void)
+{
+    static contention_t direct, regions;
+    ds1307_stats_t direct_stats, region_stats;
+
+    direct.ds1307_handle = test_ds1307_init(false);
+    contend(&direct, &direct_stats);
+
+    regions.ds1307_handle = test_ds1307_init(false);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_ram_pool_new(regions.ds1307_handle, 0, 0,
+                                                  &regions.pool));
+    for (int i = 0; i < WRITERS; i++) {
+        char name[DS1307_RAM_REGION_NAME_MAX];
+        snprintf(name, sizeof(name), "owner%u", (uint8_t)i);
+        TEST_ASSERT_EQUAL(ESP_OK,
+                          ds1307_ram_region_alloc(regions.pool, name,
+                                                  REGION_SIZE,
+                                                  &regions.regions[i]));
+    }
+    contend(&regions, &region_stats);
+
+    uint32_t direct_bus = direct_stats.read_count + direct_stats.write_count;
+    uint32_t region_bus = region_stats.read_count + region_stats.write_count;
+    printf("%d writers, %d ms at 100 kHz\n", WRITERS, RUN_MS);
+    printf("set_ram: %" PRIu32 " writes, %" PRIu32 " transactions, %" PRIu32
+           " lock waits, %" PRIu64 " us waited\n",
+           total_writes(&direct), direct_bus, direct_stats.lock_wait_count,
+           direct_stats.lock_wait_us);
+    printf("regions: %" PRIu32 " writes, %" PRIu32 " transactions, %" PRIu32
+           " lock waits, %" PRIu64 " us waited\n",
+           total_writes(&regions), region_bus, region_stats.lock_wait_count,
+           region_stats.lock_wait_us);
+    TEST_ASSERT_EQUAL(2 * total_writes(&direct), direct_bus);
+    TEST_ASSERT_LESS_OR_EQUAL(RUN_MS / FLUSH_MS + 1, region_bus);
+    TEST_ASSERT_EQUAL(0, region_stats.lock_wait_count);
+
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_ram_pool_del(regions.pool));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(regions.ds1307_handle));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(direct.ds1307_handle));
+}
+
+void test_ram_region(void)
+{
+    RUN_TEST(test_flush_merges);
+    RUN_TEST(test_contention);
+}
@@ -0,0 +1,132 @@
+/*
+ * Read-modify-write against a ticking chip: writes that share a register
+ * with the clock must not put back a value a tick has already changed, even
+ * when the tick phase the driver knows has gone stale.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "test_ds1307.h"
+
+static void sleep_until(int64_t at_us)
+{
+    while (ds1307_sim_now() < at_us) {
+        vTaskDelay(1);
+    }
+}
+
+/* Time the chip restarted its countdown for the i-th logged write */
+static int64_t write_at(size_t index)
+{
+    const ds1307_sim_xfer_t *xfer = ds1307_sim_log(index);
+    TEST_ASSERT_NOT_NULL(xfer);
+    TEST_ASSERT_FALSE(xfer->read);
+    return xfer->at_us;
+}
+
+static void test_12_hour_stale_phase(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    struct tm tm = {
+        .tm_year = 124,
+        .tm_mon = 4,
+        .tm_mday = 15,
+        .tm_wday = 3,
+        .tm_hour = 10,
+        .tm_min = 59,
+        .tm_sec = 58,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_start_datetime(ds1307_handle, &tm));
+    int64_t set_us = ds1307_sim_now();
+
+    // another master sets 10:59:59 half a second in: the tick the driver
+    // expects at set_us + 1 s comes half a second late
+    sleep_until(set_us + 500000);
+    static const uint8_t sec = 0x59;
+    ds1307_sim_write(0, &sec, 1);
+    ds1307_sim_tick_before_write();
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_12_hour(ds1307_handle, true));
+
+    static const uint8_t hour_11_am[] = {0x51}; // the carry kept
+    size_t count = ds1307_sim_log_count();
+    test_expect_xfer(count - 1, false, 0x02, 1);
+    test_expect_payload(count - 1, hour_11_am, sizeof(hour_11_am));
+    uint8_t hour;
+    ds1307_sim_read(2, &hour, 1);
+    TEST_ASSERT_EQUAL_HEX8(0x51, hour);
+    TEST_ASSERT_EQUAL(0, ds1307_sim_stale_writes());
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_halt_stale_phase(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    struct tm tm = {
+        .tm_year = 124,
+        .tm_mon = 4,
+        .tm_mday = 15,
+        .tm_wday = 3,
+        .tm_hour = 10,
+        .tm_min = 20,
+        .tm_sec = 30,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_start_datetime(ds1307_handle, &tm));
+    int64_t set_us = ds1307_sim_now();
+
+    sleep_until(set_us + 500000);
+    static const uint8_t sec = 0x30;
+    ds1307_sim_write(0, &sec, 1);
+    int64_t tick_us = ds1307_sim_now() + 1000000;
+
+    // the driver expects the tick within the guard, but it is 500 ms later
+    sleep_until(set_us + 985000);
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_halt(ds1307_handle, true));
+    size_t count = ds1307_sim_log_count();
+    int64_t late = write_at(count - 1) - tick_us;
+    TEST_ASSERT_TRUE(late >= 0 && late < 30000);
+    static const uint8_t halted_31[] = {0xb1}; // after the tick, not 0xb0
+    test_expect_payload(count - 1, halted_31, sizeof(halted_31));
+    uint8_t value;
+    ds1307_sim_read(0, &value, 1);
+    TEST_ASSERT_EQUAL_HEX8(0xb1, value);
+    TEST_ASSERT_EQUAL(0, ds1307_sim_stale_writes());
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_seconds_write_resets_phase(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    int64_t start_us = ds1307_sim_now();
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_halt(ds1307_handle, false));
+
+    // the poll above learnt the phase; set_data restarts the countdown
+    sleep_until(start_us + 1500000);
+    ds1307_data_t data;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_data(ds1307_handle, &data));
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_data(ds1307_handle, &data));
+    int64_t data_us = write_at(1);
+    const uint8_t image[] = {data.second, data.minute, data.hour, data.day,
+                             data.date,   data.month,  data.year};
+    test_expect_payload(1, image, sizeof(image));
+
+    // 20 ms before the chip's tick, but 520 ms before the old phase's
+    sleep_until(data_us + 980000);
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_halt(ds1307_handle, true));
+    size_t count = ds1307_sim_log_count();
+    int64_t offset = (write_at(count - 1) - data_us) % 1000000;
+    TEST_ASSERT_TRUE(offset < 1000000 - 30000);
+    TEST_ASSERT_EQUAL(0, ds1307_sim_stale_writes());
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+void test_rmw(void)
+{
+    RUN_TEST(test_12_hour_stale_phase);
+    RUN_TEST(test_halt_stale_phase);
+    RUN_TEST(test_seconds_write_resets_phase);
+}
@@ -0,0 +1,104 @@
+/*
+ * Time source selection: a source qualifies by its accuracy plus its
+ * resolution rounded up to 1 ms, the cheapest qualifying one answers, and
+ * accuracies can be updated after the sources are added.
+ */
+
+#include "ds1307_time_source.h"
+#include "test_ds1307.h"
+
+static ds1307_time_selector_handle_t selector_new(
+    ds1307_handle_t ds1307_handle)
+{
+    ds1307_time_selector_handle_t selector;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_time_selector_new(&selector));
+    ds1307_time_source_t source;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_time_source_system(10000, &source));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_time_selector_add(selector, &source));
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_time_source_rtc(ds1307_handle, 500, &source));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_time_selector_add(selector, &source));
+    return selector;
+}
+
+static void test_time_source_resolution(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    ds1307_time_selector_handle_t selector = selector_new(ds1307_handle);
+    test_begin(ds1307_handle);
+
+    // the RTC reports microseconds: 500 ms, plus 1 us rounded up to 1 ms
+    struct timeval tv;
+    const char *name = NULL;
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND,
+                      ds1307_time_selector_read(selector, 500, &tv, &name));
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_time_selector_read(selector, 501, &tv, &name));
+    TEST_ASSERT_EQUAL_STRING("ds1307", name);
+    TEST_ASSERT_EQUAL(TEST_TIME_SECONDS, tv.tv_sec);
+
+    // the cheaper system clock wins once it qualifies
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_time_selector_read(selector, 10001, &tv, &name));
+    TEST_ASSERT_EQUAL_STRING("system", name);
+    test_expect_stats(ds1307_handle, 1, 0, 7, 1);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_time_selector_del(selector));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static esp_err_t coarse_read(void *ctx, struct timeval *tv)
+{
+    *tv = (struct timeval){.tv_sec = TEST_TIME_SECONDS};
+    return ESP_OK;
+}
+
+static void test_time_source_rounding(void)
+{
+    ds1307_time_selector_handle_t selector;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_time_selector_new(&selector));
+    const ds1307_time_source_t source = {
+        .name = "coarse",
+        .resolution_us = 1500,
+        .accuracy_ms = 10,
+        .read = coarse_read,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_time_selector_add(selector, &source));
+
+    // 1500 us counts as 2 ms, not 1
+    struct timeval tv;
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND,
+                      ds1307_time_selector_read(selector, 11, &tv, NULL));
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_time_selector_read(selector, 12, &tv, NULL));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_time_selector_del(selector));
+}
+
+static void test_time_source_set_accuracy(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    ds1307_time_selector_handle_t selector = selector_new(ds1307_handle);
+    test_begin(ds1307_handle);
+
+    // an SNTP sync: the system clock is now good to 20 ms
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_time_selector_set_accuracy(
+                                  selector, "system", 20));
+    struct timeval tv;
+    const char *name = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_time_selector_read(selector, 100, &tv, &name));
+    TEST_ASSERT_EQUAL_STRING("system", name);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ds1307_time_selector_set_accuracy(
+                                             selector, "gps", 1));
+    test_expect_stats(ds1307_handle, 0, 0, 0, 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_time_selector_del(selector));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+void test_time_source(void)
+{
+    RUN_TEST(test_time_source_resolution);
+    RUN_TEST(test_time_source_rounding);
+    RUN_TEST(test_time_source_set_accuracy);
+}
@@ -0,0 +1,442 @@
+/*
+ * Exact bus cost of every API: which registers each call reads and writes,
+ * in how many transactions, cross-checked against ds1307_get_stats.
+ */
+
+#include "Mocki2c_master.h"
+#include "test_ds1307.h"
+#include <string.h>
+
+static void test_get_datetime(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    test_begin(ds1307_handle);
+
+    struct tm tm;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    test_expect_xfer(0, true, 0x00, 7);
+    test_expect_stats(ds1307_handle, 1, 0, 7, 1);
+    TEST_ASSERT_EQUAL(2024 - 1900, tm.tm_year);
+    TEST_ASSERT_EQUAL(4, tm.tm_mon); // 0-11, like struct tm
+    TEST_ASSERT_EQUAL(15, tm.tm_mday);
+    TEST_ASSERT_EQUAL(3, tm.tm_wday);
+    TEST_ASSERT_EQUAL(10, tm.tm_hour);
+    TEST_ASSERT_EQUAL(20, tm.tm_min);
+    TEST_ASSERT_EQUAL(30, tm.tm_sec);
+
+    test_begin(ds1307_handle);
+    struct timeval tv;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_timeval(ds1307_handle, &tv));
+    test_expect_xfer(0, true, 0x00, 7);
+    test_expect_stats(ds1307_handle, 1, 0, 7, 1);
+    TEST_ASSERT_EQUAL(TEST_TIME_SECONDS, tv.tv_sec);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_set_datetime(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    test_begin(ds1307_handle);
+
+    struct tm tm = {
+        .tm_year = 2031 - 1900,
+        .tm_mon = 11,
+        .tm_mday = 31,
+        .tm_wday = 3,
+        .tm_hour = 23,
+        .tm_min = 59,
+        .tm_sec = 58,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_datetime(ds1307_handle, &tm));
+    test_expect_xfer(0, true, 0x00, 3); // CH and the 12/24-hour bit
+    test_expect_xfer(1, false, 0x00, 7);
+    test_expect_stats(ds1307_handle, 1, 1, 3, 1 + 8);
+    static const uint8_t expected[] = {0x58, 0x59, 0x23, 0x04,
+                                       0x31, 0x12, 0x31};
+    test_expect_payload(1, expected, sizeof(expected));
+
+    // the write restarted the countdown: the time is cached, phase aligned
+    test_begin(ds1307_handle);
+    struct timeval tv;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_timeval_isr(ds1307_handle, &tv));
+    test_expect_stats(ds1307_handle, 0, 0, 0, 0);
+
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_start_datetime(ds1307_handle, &tm));
+    test_expect_xfer(0, true, 0x00, 3);
+    test_expect_xfer(1, false, 0x00, 7);
+    test_expect_stats(ds1307_handle, 1, 1, 3, 1 + 8);
+    test_expect_payload(1, expected, sizeof(expected)); // CH clear
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_set_timeval_aligned(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    test_begin(ds1307_handle);
+
+    struct timeval tv = {.tv_sec = TEST_TIME_SECONDS, .tv_usec = 500000};
+    int64_t boundary = ds1307_sim_now() + 500000;
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_set_timeval_aligned(ds1307_handle, &tv));
+    test_expect_xfer(0, true, 0x00, 3);
+    test_expect_xfer(1, false, 0x00, 7);
+    test_expect_stats(ds1307_handle, 1, 1, 3, 1 + 8);
+    // 2024-05-15 10:20:31, the second after tv
+    static const uint8_t expected[] = {0x31, 0x20, 0x10, 0x04,
+                                       0x15, 0x05, 0x24};
+    test_expect_payload(1, expected, sizeof(expected));
+    // the seconds byte lands on the boundary, less its own bus time
+    int64_t late = ds1307_sim_log(1)->at_us - boundary;
+    TEST_ASSERT_TRUE(late > -20000 && late < 20000);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_set_timeval_aligned_late(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    test_begin(ds1307_handle);
+
+    // a slow bus: the boundary has passed by the time the read is done
+    ds1307_sim_set_bus_speed(1000);
+    struct timeval tv = {.tv_sec = TEST_TIME_SECONDS, .tv_usec = 989000};
+    int64_t boundary = ds1307_sim_now() + 11000;
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_set_timeval_aligned(ds1307_handle, &tv));
+    ds1307_sim_set_bus_speed(0);
+    test_expect_xfer(1, false, 0x00, 7);
+    static const uint8_t expected[] = {0x32, 0x20, 0x10, 0x04,
+                                       0x15, 0x05, 0x24};
+    test_expect_payload(1, expected, sizeof(expected));
+    int64_t late = ds1307_sim_log(1)->at_us - (boundary + 1000000);
+    TEST_ASSERT_TRUE(late > -20000 && late < 20000);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_cached_isr(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    struct tm tm;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+
+    test_begin(ds1307_handle);
+    struct timeval tv;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ds1307_get_timeval_isr(NULL, &tv));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_timeval_isr(ds1307_handle, &tv));
+    TEST_ASSERT_EQUAL(TEST_TIME_SECONDS, tv.tv_sec);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_sqw_edge(ds1307_handle));
+
+    // an edge too late to round in 32 bits is refused, not wrapped
+    ds1307_sim_skip(UINT32_MAX - 500000LL);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, ds1307_sqw_edge(ds1307_handle));
+    test_expect_stats(ds1307_handle, 0, 0, 0, 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_raw_registers(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    test_begin(ds1307_handle);
+
+    ds1307_data_t data;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_data(ds1307_handle, &data));
+    test_expect_xfer(0, true, 0x00, 7);
+    test_expect_stats(ds1307_handle, 1, 0, 7, 1);
+
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_data(ds1307_handle, &data));
+    test_expect_xfer(0, true, 0x00, 1); // CH
+    test_expect_xfer(1, false, 0x00, 7);
+    test_expect_stats(ds1307_handle, 1, 1, 1, 1 + 8);
+    static const uint8_t time[] = TEST_TIME_REGS;
+    test_expect_payload(1, time, sizeof(time));
+
+    test_begin(ds1307_handle);
+    uint8_t regs[DS1307_REG_IMAGE_SIZE];
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_registers(ds1307_handle, regs));
+    test_expect_xfer(0, true, 0x00, DS1307_REG_IMAGE_SIZE);
+    test_expect_stats(ds1307_handle, 1, 0, DS1307_REG_IMAGE_SIZE, 1);
+    TEST_ASSERT_EQUAL_HEX8(0x03, regs[7]); // control power-on value
+
+    // the flags come out of the image without another transaction
+    ds1307_status_t status;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_decode_status(regs, &status));
+    TEST_ASSERT_FALSE(status.halt);
+    TEST_ASSERT_FALSE(status.hour_12);
+    TEST_ASSERT_FALSE(status.output);
+    TEST_ASSERT_FALSE(status.square_wave_enable);
+    TEST_ASSERT_EQUAL(DS1307_RATE_SELECT_32768HZ, status.rate_select);
+    test_expect_stats(ds1307_handle, 1, 0, DS1307_REG_IMAGE_SIZE, 1);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_hour_mode(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    test_begin(ds1307_handle);
+
+    bool mode;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_12_hour(ds1307_handle, &mode));
+    test_expect_xfer(0, true, 0x02, 1);
+    test_expect_stats(ds1307_handle, 1, 0, 1, 1);
+    TEST_ASSERT_FALSE(mode);
+
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_12_hour(ds1307_handle, true));
+    test_expect_xfer(0, true, 0x00, 3); // seconds and minutes for the carry
+    test_expect_xfer(1, false, 0x02, 1);
+    test_expect_stats(ds1307_handle, 1, 1, 3, 1 + 2);
+    static const uint8_t hour_10_am[] = {0x50};
+    test_expect_payload(1, hour_10_am, sizeof(hour_10_am));
+
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_12_hour(ds1307_handle, true));
+    test_expect_stats(ds1307_handle, 1, 0, 3, 1); // already 12-hour
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_halt(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_begin(ds1307_handle);
+
+    bool halt;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_halt(ds1307_handle, &halt));
+    test_expect_xfer(0, true, 0x00, 1);
+    test_expect_stats(ds1307_handle, 1, 0, 1, 1);
+    TEST_ASSERT_TRUE(halt); // power-on state
+
+    // a halted clock has no tick to keep clear of
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_halt(ds1307_handle, false));
+    test_expect_xfer(0, true, 0x00, 1);
+    test_expect_xfer(1, false, 0x00, 1);
+    test_expect_stats(ds1307_handle, 1, 1, 1, 1 + 2);
+    static const uint8_t running[] = {0x00};
+    test_expect_payload(1, running, sizeof(running));
+
+    // right after a seconds write the tick is a second away
+    struct tm tm = {.tm_year = 124, .tm_mon = 4, .tm_mday = 15, .tm_wday = 3};
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_datetime(ds1307_handle, &tm));
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_halt(ds1307_handle, true));
+    test_expect_xfer(0, true, 0x00, 1);
+    test_expect_xfer(1, false, 0x00, 1);
+    test_expect_stats(ds1307_handle, 1, 1, 1, 1 + 2);
+    static const uint8_t halted[] = {0x80};
+    test_expect_payload(1, halted, sizeof(halted));
+    TEST_ASSERT_EQUAL(0, ds1307_sim_stale_writes());
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_control(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_begin(ds1307_handle);
+
+    bool enable;
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_get_square_wave_enable(ds1307_handle, &enable));
+    test_expect_xfer(0, true, 0x07, 1);
+    test_expect_stats(ds1307_handle, 1, 0, 1, 1);
+    TEST_ASSERT_FALSE(enable);
+
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_set_square_wave_enable(ds1307_handle, true));
+    test_expect_xfer(0, true, 0x07, 1);
+    test_expect_xfer(1, false, 0x07, 1);
+    test_expect_stats(ds1307_handle, 1, 1, 1, 1 + 2);
+    static const uint8_t sqwe[] = {0x13};
+    test_expect_payload(1, sqwe, sizeof(sqwe));
+
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_rate_select(
+                                  ds1307_handle, DS1307_RATE_SELECT_32768HZ));
+    test_expect_stats(ds1307_handle, 1, 0, 1, 1); // unchanged, not written
+
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_output(ds1307_handle, true));
+    test_expect_xfer(1, false, 0x07, 1);
+    test_expect_stats(ds1307_handle, 1, 1, 1, 1 + 2);
+    static const uint8_t out[] = {0x93};
+    test_expect_payload(1, out, sizeof(out));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_ram(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_begin(ds1307_handle);
+
+    uint8_t data[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10}, out[10];
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_set_ram(ds1307_handle, 5, data, sizeof(data)));
+    test_expect_xfer(0, false, 0x08 + 5, sizeof(data));
+    test_expect_stats(ds1307_handle, 0, 1, 0, 1 + sizeof(data));
+    test_expect_payload(0, data, sizeof(data));
+
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_get_ram(ds1307_handle, 5, out, sizeof(out)));
+    test_expect_xfer(0, true, 0x08 + 5, sizeof(out));
+    test_expect_stats(ds1307_handle, 1, 0, sizeof(out), 1);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data, out, sizeof(data));
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                      ds1307_get_ram(ds1307_handle, 50, out, sizeof(out)));
+    uint8_t offset, size;
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_get_ram_range(ds1307_handle, &offset, &size));
+    TEST_ASSERT_EQUAL(0, offset);
+    TEST_ASSERT_EQUAL(DS1307_RAM_SIZE, size);
+    test_expect_stats(ds1307_handle, 1, 0, sizeof(out), 1);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_low_power(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_start_clock();
+    test_begin(ds1307_handle);
+
+    const ds1307_low_power_config_t low_power = {
+        .cache_ms = 60000,
+        .ram_write_back = true,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_low_power(ds1307_handle, &low_power));
+    test_expect_stats(ds1307_handle, 0, 0, 0, 0);
+
+    struct tm tm;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    test_expect_xfer(0, true, 0x00, 7);
+    test_expect_stats(ds1307_handle, 1, 0, 7, 1); // the second one cached
+
+    // staged bytes 0-1 and 4-5: the 2-byte gap is known, one burst
+    test_begin(ds1307_handle);
+    uint8_t data[6] = {0};
+    static const uint8_t head[] = {0x11, 0x22}, tail[] = {0x55, 0x66};
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_ram(ds1307_handle, 0, data, 6));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_ram(ds1307_handle, 0, head, 2));
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_ram(ds1307_handle, 4, tail, 2));
+    test_expect_stats(ds1307_handle, 1, 0, 6, 1);
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_flush_ram(ds1307_handle));
+    test_expect_xfer(0, false, 0x08, 6);
+    test_expect_stats(ds1307_handle, 0, 1, 0, 1 + 6);
+    static const uint8_t burst[] = {0x11, 0x22, 0x00, 0x00, 0x55, 0x66};
+    test_expect_payload(0, burst, sizeof(burst));
+
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_flush_ram(ds1307_handle));
+    test_expect_stats(ds1307_handle, 0, 0, 0, 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+static void test_multi_master(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(true);
+    test_start_clock();
+    test_begin(ds1307_handle);
+
+    // time reads run on through control to the generation byte
+    struct tm tm;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_datetime(ds1307_handle, &tm));
+    test_expect_xfer(0, true, 0x00, 9);
+    test_expect_stats(ds1307_handle, 1, 0, 9, 1);
+
+    // RAM writes check the generation first and bump it in the burst
+    test_begin(ds1307_handle);
+    uint8_t data[2] = {0xaa, 0x55};
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_ram(ds1307_handle, 1, data, 2));
+    test_expect_xfer(0, true, 0x08, 1);
+    test_expect_xfer(1, false, 0x08, 3);
+    test_expect_stats(ds1307_handle, 1, 1, 1, 1 + 4);
+    static const uint8_t gen_1[] = {0x01, 0xaa, 0x55};
+    test_expect_payload(1, gen_1, sizeof(gen_1));
+
+    // far from the generation byte, it takes a write of its own
+    test_begin(ds1307_handle);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_set_ram(ds1307_handle, 20, data, 2));
+    test_expect_xfer(0, true, 0x08, 1);
+    test_expect_xfer(1, false, 0x08 + 20, 2);
+    test_expect_xfer(2, false, 0x08, 1);
+    test_expect_stats(ds1307_handle, 1, 2, 1, 1 + 3 + 2);
+    test_expect_payload(1, data, sizeof(data));
+    static const uint8_t gen_2[] = {0x02};
+    test_expect_payload(2, gen_2, sizeof(gen_2));
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                      ds1307_set_ram(ds1307_handle, 0, data, 2));
+    // the range to use instead, known without a failing call
+    uint8_t offset, size;
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      ds1307_get_ram_range(ds1307_handle, &offset, &size));
+    TEST_ASSERT_EQUAL(DS1307_RAM_GEN_OFFSET + 1, offset);
+    TEST_ASSERT_EQUAL(DS1307_RAM_SIZE - 1, size);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+/* Failures come straight from CMock expectations, not the simulation */
+static void test_bus_error(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_begin(ds1307_handle);
+
+    i2c_master_transmit_receive_Stub(NULL);
+    i2c_master_transmit_receive_ExpectAnyArgsAndReturn(ESP_ERR_TIMEOUT);
+    struct tm tm;
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT,
+                      ds1307_get_datetime(ds1307_handle, &tm));
+    ds1307_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_get_stats(ds1307_handle, &stats));
+    TEST_ASSERT_EQUAL_UINT32(1, stats.read_count);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.error_count);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+/* NULL arguments are rejected before the bus, with the component's one code */
+static void test_null_args(void)
+{
+    ds1307_handle_t ds1307_handle = test_ds1307_init(false);
+    test_begin(ds1307_handle);
+
+    struct tm tm;
+    struct timeval tv;
+    ds1307_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ds1307_get_datetime(NULL, &tm));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                      ds1307_get_datetime(ds1307_handle, NULL));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ds1307_get_timeval(NULL, &tv));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                      ds1307_set_timeval(ds1307_handle, NULL));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ds1307_get_stats(NULL, &stats));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ds1307_deinit(NULL));
+    test_expect_stats(ds1307_handle, 0, 0, 0, 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ds1307_deinit(ds1307_handle));
+}
+
+void test_transactions(void)
+{
+    RUN_TEST(test_get_datetime);
+    RUN_TEST(test_set_datetime);
+    RUN_TEST(test_set_timeval_aligned);
+    RUN_TEST(test_set_timeval_aligned_late);
+    RUN_TEST(test_cached_isr);
+    RUN_TEST(test_raw_registers);
+    RUN_TEST(test_hour_mode);
+    RUN_TEST(test_halt);
+    RUN_TEST(test_control);
+    RUN_TEST(test_ram);
+    RUN_TEST(test_low_power);
+    RUN_TEST(test_multi_master);
+    RUN_TEST(test_bus_error);
+    RUN_TEST(test_null_args);
+}
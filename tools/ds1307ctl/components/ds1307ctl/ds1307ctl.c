@@ -0,0 +1,563 @@
+#include "ds1307ctl.h"
+#include "esp_timer.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_ITERATIONS 100
+#define ITERATIONS_MAX 1000000
+#define SYNC_POLL_US 500
+#define SYNC_POLL_LIMIT 4000 // a second and a half at the slowest
+
+typedef struct {
+    ds1307_handle_t ds1307_handle;
+    bool json;
+    FILE *out;
+} ctl_t;
+
+typedef struct {
+    const char *name;
+    int (*run)(const ctl_t *ctl, int argc, char **argv);
+} command_t;
+
+static int fail(const ctl_t *ctl, const char *error)
+{
+    if (ctl->json) {
+        fprintf(ctl->out, "{\"error\": \"%s\"}\n", error);
+    } else {
+        fprintf(ctl->out, "error: %s\n", error);
+    }
+    return DS1307CTL_EXIT_ERROR;
+}
+
+static int usage(void)
+{
+    ds1307ctl_usage(stderr);
+    return DS1307CTL_EXIT_USAGE;
+}
+
+/* A whole argument as a number no greater than max */
+static bool parse(const char *arg, int base, unsigned long max,
+                  unsigned long *value)
+{
+    char *end;
+    *value = strtoul(arg, &end, base);
+    return end != arg && *end == '\0' && arg[0] != '-' && *value <= max;
+}
+
+static int64_t tv_us(const struct timeval *tv)
+{
+    return tv->tv_sec * 1000000LL + tv->tv_usec;
+}
+
+static void print_hex(FILE *out, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        fprintf(out, "%02x", data[i]);
+    }
+}
+
+static void dump(FILE *out, uint8_t base, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (i % 16 == 0) {
+            fprintf(out, "%s0x%02x:", i ? "\n" : "", (unsigned)(base + i));
+        }
+        fprintf(out, " %02x", data[i]);
+    }
+    fprintf(out, "\n");
+}
+
+static void print_time(const ctl_t *ctl, const struct tm *tm)
+{
+    struct tm utc = *tm;
+    char buf[32];
+    strftime(buf, sizeof(buf), ctl->json ? "%Y-%m-%dT%H:%M:%SZ"
+                                         : "%Y-%m-%d %H:%M:%S",
+             tm);
+    if (ctl->json) {
+        fprintf(ctl->out, "\"time\": \"%s\", \"seconds\": %lld", buf,
+                (long long)timegm(&utc));
+    } else {
+        fprintf(ctl->out, "%s", buf);
+    }
+}
+
+static int cmd_get(const ctl_t *ctl, int argc, char **argv)
+{
+    if (argc != 1) {
+        return usage();
+    }
+    struct tm tm;
+    bool halt;
+    esp_err_t ret = ds1307_get_datetime(ctl->ds1307_handle, &tm);
+    if (ret == ESP_OK) {
+        ret = ds1307_get_halt(ctl->ds1307_handle, &halt);
+    }
+    if (ret != ESP_OK) {
+        return fail(ctl, esp_err_to_name(ret));
+    }
+    if (ctl->json) {
+        fprintf(ctl->out, "{");
+        print_time(ctl, &tm);
+        fprintf(ctl->out, ", \"weekday\": %d, \"halt\": %s}\n", tm.tm_wday,
+                halt ? "true" : "false");
+    } else {
+        print_time(ctl, &tm);
+        fprintf(ctl->out, " weekday %d%s\n", tm.tm_wday,
+                halt ? " halted" : "");
+    }
+    return DS1307CTL_EXIT_OK;
+}
+
+/* The aligned write restarts the countdown, so a halted clock starts first */
+static int set_aligned(const ctl_t *ctl)
+{
+    bool halt;
+    struct timeval tv, rtc;
+    esp_err_t ret = ds1307_get_halt(ctl->ds1307_handle, &halt);
+    if (ret == ESP_OK && halt) {
+        ret = ds1307_set_halt(ctl->ds1307_handle, false);
+    }
+    if (ret == ESP_OK) {
+        gettimeofday(&tv, NULL);
+        ret = ds1307_set_timeval_aligned(ctl->ds1307_handle, &tv);
+    }
+    if (ret == ESP_OK) { // exact: the phase is known from the write
+        ret = ds1307_get_timeval(ctl->ds1307_handle, &rtc);
+        gettimeofday(&tv, NULL);
+    }
+    if (ret != ESP_OK) {
+        return fail(ctl, esp_err_to_name(ret));
+    }
+    int64_t offset_us = tv_us(&tv) - tv_us(&rtc);
+    struct tm tm;
+    gmtime_r(&rtc.tv_sec, &tm);
+    if (ctl->json) {
+        fprintf(ctl->out, "{");
+        print_time(ctl, &tm);
+        fprintf(ctl->out, ", \"offset_us\": %" PRId64 "}\n", offset_us);
+    } else {
+        print_time(ctl, &tm);
+        fprintf(ctl->out, " set, system clock %+.6f s from the chip\n",
+                offset_us / 1e6);
+    }
+    return DS1307CTL_EXIT_OK;
+}
+
+static int cmd_set(const ctl_t *ctl, int argc, char **argv)
+{
+    if (argc == 1) {
+        return set_aligned(ctl);
+    }
+    struct tm tm = {0};
+    int year, mon;
+    char extra;
+    if (argc != 3 ||
+        sscanf(argv[1], "%d-%d-%d%c", &year, &mon, &tm.tm_mday, &extra) != 3 ||
+        sscanf(argv[2], "%d:%d:%d%c", &tm.tm_hour, &tm.tm_min, &tm.tm_sec,
+               &extra) != 3 ||
+        year < 1 || mon < 1 || mon > 12) {
+        return usage();
+    }
+    tm.tm_year = year - 1900;
+    tm.tm_mon = mon - 1;
+    struct tm utc = tm;
+    timegm(&utc);
+    tm.tm_wday = utc.tm_wday;
+    // out of range fields are left for the driver to refuse
+    esp_err_t ret = ds1307_start_datetime(ctl->ds1307_handle, &tm);
+    if (ret != ESP_OK) {
+        return fail(ctl, esp_err_to_name(ret));
+    }
+    if (ctl->json) {
+        fprintf(ctl->out, "{");
+        print_time(ctl, &tm);
+        fprintf(ctl->out, "}\n");
+    } else {
+        print_time(ctl, &tm);
+        fprintf(ctl->out, " set\n");
+    }
+    return DS1307CTL_EXIT_OK;
+}
+
+/*
+ * Poll the chip until its seconds change. The tick fell between the two
+ * reads; each read is taken to latch halfway through, so the estimate is
+ * good to half the poll interval plus a read.
+ */
+static esp_err_t wait_tick(ds1307_handle_t ds1307_handle, time_t *seconds,
+                           int64_t *tick_us)
+{
+    struct timeval before, after, rtc;
+    gettimeofday(&before, NULL);
+    esp_err_t ret = ds1307_get_timeval_running(ds1307_handle, &rtc);
+    gettimeofday(&after, NULL);
+    time_t first = rtc.tv_sec;
+    int64_t latch_us = (tv_us(&before) + tv_us(&after)) / 2;
+    for (int i = 0; i < SYNC_POLL_LIMIT && ret == ESP_OK; i++) {
+        usleep(SYNC_POLL_US);
+        gettimeofday(&before, NULL);
+        ret = ds1307_get_timeval_running(ds1307_handle, &rtc);
+        gettimeofday(&after, NULL);
+        int64_t next_us = (tv_us(&before) + tv_us(&after)) / 2;
+        if (ret == ESP_OK && rtc.tv_sec != first) {
+            *seconds = rtc.tv_sec;
+            *tick_us = (latch_us + next_us) / 2;
+            return ESP_OK;
+        }
+        latch_us = next_us;
+    }
+    return ret == ESP_OK ? ESP_ERR_TIMEOUT : ret;
+}
+
+static int cmd_sync(const ctl_t *ctl, int argc, char **argv)
+{
+    bool dry_run = argc == 2 && strcmp(argv[1], "--dry-run") == 0;
+    if (argc != 1 && !dry_run) {
+        return usage();
+    }
+    time_t seconds;
+    int64_t tick_us;
+    esp_err_t ret = wait_tick(ctl->ds1307_handle, &seconds, &tick_us);
+    if (ret != ESP_OK) {
+        return fail(ctl, esp_err_to_name(ret));
+    }
+    int64_t offset_us = tick_us - seconds * 1000000LL;
+    if (!dry_run) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        int64_t set_us = tv_us(&now) - offset_us;
+        now.tv_sec = set_us / 1000000;
+        now.tv_usec = set_us % 1000000;
+        if (settimeofday(&now, NULL) != 0) {
+            return fail(ctl, strerror(errno));
+        }
+    }
+    if (ctl->json) {
+        fprintf(ctl->out,
+                "{\"seconds\": %lld, \"offset_us\": %" PRId64
+                ", \"set\": %s}\n",
+                (long long)seconds, offset_us, dry_run ? "false" : "true");
+    } else {
+        fprintf(ctl->out, "system clock %+.6f s from the chip%s\n",
+                offset_us / 1e6, dry_run ? "" : ", set");
+    }
+    return DS1307CTL_EXIT_OK;
+}
+
+static int cmd_status(const ctl_t *ctl, int argc, char **argv)
+{
+    static const int rates[] = {1, 4096, 8192, 32768};
+    if (argc != 1) {
+        return usage();
+    }
+    uint8_t regs[DS1307_REG_IMAGE_SIZE];
+    ds1307_status_t status;
+    esp_err_t ret = ds1307_get_registers(ctl->ds1307_handle, regs);
+    if (ret == ESP_OK) {
+        ret = ds1307_decode_status(regs, &status);
+    }
+    if (ret != ESP_OK) {
+        return fail(ctl, esp_err_to_name(ret));
+    }
+    if (ctl->json) {
+        fprintf(ctl->out,
+                "{\"halt\": %s, \"hour_12\": %s, \"square_wave\": %s, "
+                "\"rate_hz\": %d, \"output\": %s}\n",
+                status.halt ? "true" : "false",
+                status.hour_12 ? "true" : "false",
+                status.square_wave_enable ? "true" : "false",
+                rates[status.rate_select], status.output ? "true" : "false");
+        return DS1307CTL_EXIT_OK;
+    }
+    fprintf(ctl->out, "clock: %s\n", status.halt ? "halted" : "running");
+    fprintf(ctl->out, "hour mode: %s\n",
+            status.hour_12 ? "12-hour" : "24-hour");
+    if (status.square_wave_enable) {
+        fprintf(ctl->out, "SQW/OUT: square wave %d Hz\n",
+                rates[status.rate_select]);
+    } else {
+        fprintf(ctl->out, "SQW/OUT: static %s\n",
+                status.output ? "high" : "low");
+    }
+    return DS1307CTL_EXIT_OK;
+}
+
+static int regs_diff(const ctl_t *ctl, const uint8_t *regs, const char *path)
+{
+    uint8_t saved[DS1307_REG_IMAGE_SIZE];
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return fail(ctl, strerror(errno));
+    }
+    size_t size = fread(saved, 1, sizeof(saved), f);
+    fclose(f);
+    if (size != sizeof(saved)) {
+        return fail(ctl, "short register file");
+    }
+    const char *sep = "";
+    if (ctl->json) {
+        fprintf(ctl->out, "{\"diff\": [");
+    }
+    for (int i = 0; i < DS1307_REG_IMAGE_SIZE; i++) {
+        if (saved[i] == regs[i]) {
+            continue;
+        }
+        if (ctl->json) {
+            fprintf(ctl->out, "%s{\"reg\": %d, \"old\": %d, \"new\": %d}",
+                    sep, i, saved[i], regs[i]);
+            sep = ", ";
+        } else {
+            fprintf(ctl->out, "0x%02x: %02x -> %02x\n", i, saved[i], regs[i]);
+        }
+    }
+    if (ctl->json) {
+        fprintf(ctl->out, "]}\n");
+    }
+    return DS1307CTL_EXIT_OK;
+}
+
+static int cmd_regs(const ctl_t *ctl, int argc, char **argv)
+{
+    bool save = argc == 3 && strcmp(argv[1], "save") == 0;
+    bool diff = argc == 3 && strcmp(argv[1], "diff") == 0;
+    if (argc != 1 && !save && !diff) {
+        return usage();
+    }
+    uint8_t regs[DS1307_REG_IMAGE_SIZE];
+    esp_err_t ret = ds1307_get_registers(ctl->ds1307_handle, regs);
+    if (ret != ESP_OK) {
+        return fail(ctl, esp_err_to_name(ret));
+    }
+    if (diff) {
+        return regs_diff(ctl, regs, argv[2]);
+    }
+    if (save) {
+        FILE *f = fopen(argv[2], "wb");
+        if (!f) {
+            return fail(ctl, strerror(errno));
+        }
+        size_t size = fwrite(regs, 1, sizeof(regs), f);
+        if (fclose(f) != 0 || size != sizeof(regs)) {
+            return fail(ctl, strerror(errno));
+        }
+    }
+    if (ctl->json) {
+        fprintf(ctl->out, "{\"regs\": \"");
+        print_hex(ctl->out, regs, sizeof(regs));
+        fprintf(ctl->out, "\"}\n");
+    } else {
+        dump(ctl->out, 0, regs, sizeof(regs));
+    }
+    return DS1307CTL_EXIT_OK;
+}
+
+static int ram_read(const ctl_t *ctl, int argc, char **argv)
+{
+    uint8_t data[DS1307_RAM_SIZE], offset, size;
+    unsigned long value, count = DS1307_RAM_SIZE;
+    esp_err_t ret;
+    if (argc == 2) { // less the generation byte if multi_master reserves it
+        ret = ds1307_get_ram_range(ctl->ds1307_handle, &offset, &size);
+    } else if (argc <= 4 && parse(argv[2], 0, DS1307_RAM_SIZE, &value) &&
+               (argc == 3 || parse(argv[3], 0, DS1307_RAM_SIZE, &count))) {
+        offset = value;
+        size = argc == 3 ? count - offset : count;
+        ret = ESP_OK;
+    } else {
+        return usage();
+    }
+    if (ret == ESP_OK) {
+        ret = ds1307_get_ram(ctl->ds1307_handle, offset, data, size);
+    }
+    if (ret != ESP_OK) {
+        return fail(ctl, esp_err_to_name(ret));
+    }
+    if (ctl->json) {
+        fprintf(ctl->out, "{\"offset\": %u, \"data\": \"", offset);
+        print_hex(ctl->out, data, size);
+        fprintf(ctl->out, "\"}\n");
+    } else {
+        dump(ctl->out, offset, data, size);
+    }
+    return DS1307CTL_EXIT_OK;
+}
+
+static int ram_write(const ctl_t *ctl, int argc, char **argv)
+{
+    uint8_t data[DS1307_RAM_SIZE];
+    unsigned long value;
+    if (argc < 4 || argc - 3 > DS1307_RAM_SIZE ||
+        !parse(argv[2], 0, DS1307_RAM_SIZE, &value)) {
+        return usage();
+    }
+    uint8_t offset = value, size = argc - 3;
+    for (int i = 0; i < size; i++) {
+        if (!parse(argv[3 + i], 16, 0xff, &value)) {
+            return usage();
+        }
+        data[i] = value;
+    }
+    esp_err_t ret = ds1307_set_ram(ctl->ds1307_handle, offset, data, size);
+    if (ret != ESP_OK) {
+        return fail(ctl, esp_err_to_name(ret));
+    }
+    if (ctl->json) {
+        fprintf(ctl->out, "{\"offset\": %u, \"size\": %u}\n", offset, size);
+    } else {
+        fprintf(ctl->out, "%u bytes written at 0x%02x\n", size, offset);
+    }
+    return DS1307CTL_EXIT_OK;
+}
+
+static int cmd_ram(const ctl_t *ctl, int argc, char **argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "read") == 0) {
+        return ram_read(ctl, argc, argv);
+    } else if (argc >= 2 && strcmp(argv[1], "write") == 0) {
+        return ram_write(ctl, argc, argv);
+    }
+    return usage();
+}
+
+static int compare_us(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Per-call latency of one read, sorted, and its transactions per call */
+static esp_err_t bench_read(const ctl_t *ctl, bool image, int64_t *samples,
+                            unsigned long iterations, float *transactions)
+{
+    ds1307_stats_t before, after;
+    uint8_t regs[DS1307_REG_IMAGE_SIZE];
+    struct tm tm;
+    esp_err_t ret = ds1307_get_stats(ctl->ds1307_handle, &before);
+    for (unsigned long i = 0; i < iterations && ret == ESP_OK; i++) {
+        int64_t start = esp_timer_get_time();
+        ret = image ? ds1307_get_registers(ctl->ds1307_handle, regs)
+                    : ds1307_get_datetime(ctl->ds1307_handle, &tm);
+        samples[i] = esp_timer_get_time() - start;
+    }
+    if (ret == ESP_OK) {
+        ret = ds1307_get_stats(ctl->ds1307_handle, &after);
+    }
+    if (ret == ESP_OK) {
+        qsort(samples, iterations, sizeof(samples[0]), compare_us);
+        *transactions =
+            (float)(after.read_count - before.read_count) / iterations;
+    }
+    return ret;
+}
+
+static void bench_print(const ctl_t *ctl, const char *name,
+                        const int64_t *samples, unsigned long iterations,
+                        float transactions)
+{
+    int64_t sum = 0;
+    for (unsigned long i = 0; i < iterations; i++) {
+        sum += samples[i];
+    }
+    int64_t min = samples[0], max = samples[iterations - 1],
+            p50 = samples[(iterations - 1) / 2],
+            p99 = samples[(iterations - 1) * 99 / 100];
+    float mean = (float)sum / iterations;
+    if (ctl->json) {
+        fprintf(ctl->out,
+                "\"%s\": {\"min_us\": %" PRId64 ", \"mean_us\": %.1f, "
+                "\"p50_us\": %" PRId64 ", \"p99_us\": %" PRId64
+                ", \"max_us\": %" PRId64 ", \"transactions\": %.2f}",
+                name, min, mean, p50, p99, max, transactions);
+    } else {
+        fprintf(ctl->out,
+                "%s: min %" PRId64 " mean %.1f p50 %" PRId64 " p99 %" PRId64
+                " max %" PRId64 " us, %.2f transactions/call\n",
+                name, min, mean, p50, p99, max, transactions);
+    }
+}
+
+static int cmd_bench(const ctl_t *ctl, int argc, char **argv)
+{
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    if (argc > 2 ||
+        (argc == 2 && !parse(argv[1], 0, ITERATIONS_MAX, &iterations)) ||
+        iterations == 0) {
+        return usage();
+    }
+    int64_t *datetime = calloc(iterations, sizeof(int64_t));
+    int64_t *image = calloc(iterations, sizeof(int64_t));
+    float datetime_transactions, image_transactions;
+    esp_err_t ret = datetime && image ? ESP_OK : ESP_ERR_NO_MEM;
+    if (ret == ESP_OK) {
+        ret = bench_read(ctl, false, datetime, iterations,
+                         &datetime_transactions);
+    }
+    if (ret == ESP_OK) {
+        ret = bench_read(ctl, true, image, iterations, &image_transactions);
+    }
+    if (ret == ESP_OK) {
+        if (ctl->json) {
+            fprintf(ctl->out, "{\"iterations\": %lu, ", iterations);
+        }
+        bench_print(ctl, "ds1307_get_datetime", datetime, iterations,
+                    datetime_transactions);
+        if (ctl->json) {
+            fprintf(ctl->out, ", ");
+        }
+        bench_print(ctl, "ds1307_get_registers", image, iterations,
+                    image_transactions);
+        if (ctl->json) {
+            fprintf(ctl->out, "}\n");
+        }
+    }
+    free(datetime);
+    free(image);
+    return ret == ESP_OK ? DS1307CTL_EXIT_OK
+                         : fail(ctl, esp_err_to_name(ret));
+}
+
+static const command_t commands[] = {
+    {"get", cmd_get},       {"set", cmd_set},   {"sync", cmd_sync},
+    {"status", cmd_status}, {"regs", cmd_regs}, {"ram", cmd_ram},
+    {"bench", cmd_bench},
+};
+
+int ds1307ctl_run(ds1307_handle_t ds1307_handle, bool json, int argc,
+                  char **argv, FILE *out)
+{
+    const ctl_t ctl = {
+        .ds1307_handle = ds1307_handle,
+        .json = json,
+        .out = out,
+    };
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (argc >= 1 && strcmp(argv[0], commands[i].name) == 0) {
+            return commands[i].run(&ctl, argc, argv);
+        }
+    }
+    return usage();
+}
+
+void ds1307ctl_usage(FILE *out)
+{
+    fprintf(out,
+            "commands:\n"
+            "  get                          time and clock halt flag\n"
+            "  set [YYYY-MM-DD HH:MM:SS]    set and start the clock; without "
+            "a time,\n"
+            "                               from the system clock, phase "
+            "aligned\n"
+            "  sync [--dry-run]             set the system clock from the "
+            "chip\n"
+            "  status                       control register and hour mode\n"
+            "  regs [save FILE|diff FILE]   64-byte register image\n"
+            "  ram read [OFFSET [SIZE]]     RAM, offsets from 0\n"
+            "  ram write OFFSET HEX...\n"
+            "  bench [ITERATIONS]           read latency\n");
+}
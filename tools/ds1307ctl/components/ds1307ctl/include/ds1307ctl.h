@@ -0,0 +1,49 @@
+#pragma once
+
+#include "ds1307.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+#define DS1307CTL_EXIT_OK (0)
+#define DS1307CTL_EXIT_ERROR (1) // the device or the system refused
+#define DS1307CTL_EXIT_USAGE (2)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Run one ds1307ctl command on an initialized handle
+ *
+ * Commands, argv[0] first:
+ *  - get: the time and the clock halt flag
+ *  - set [YYYY-MM-DD HH:MM:SS]: set and start the clock; without a time,
+ *    from the system clock, phase aligned
+ *  - sync [--dry-run]: set the system clock from the chip, at a seconds tick
+ *  - status: the control register and hour mode
+ *  - regs [save FILE | diff FILE]: the 64-byte register image, saved raw or
+ *    compared with a saved one
+ *  - ram read [OFFSET [SIZE]] | ram write OFFSET HEX...
+ *  - bench [ITERATIONS]: latency of time and register image reads
+ *
+ * Results go to out as text, or as one JSON object per command; errors as
+ * {"error": "<esp_err_t name>"}. Usage goes to stderr.
+ *
+ * @param[in] ds1307_handle Device handle
+ * @param[in] json JSON output instead of text
+ * @param[in] argc Number of arguments, the command included
+ * @param[in] argv The command and its arguments
+ * @param[in] out Where results go
+ * @return DS1307CTL_EXIT_OK, DS1307CTL_EXIT_ERROR or DS1307CTL_EXIT_USAGE
+ */
+int ds1307ctl_run(ds1307_handle_t ds1307_handle, bool json, int argc,
+                  char **argv, FILE *out);
+
+/**
+ * @brief Print the command list
+ */
+void ds1307ctl_usage(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,180 @@
+#include "i2c_dev.h"
+#include "Mockesp_timer.h"
+#include "Mocki2c_master.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PATH_MAX_LEN 64
+
+struct i2c_master_bus_t {
+    int fd;
+};
+
+struct i2c_master_dev_t {
+    int fd;
+    uint16_t address;
+};
+
+static char s_path[PATH_MAX_LEN];
+
+/* NACKs come back as ENXIO or EREMOTEIO depending on the adapter */
+static esp_err_t rdwr(int fd, struct i2c_msg *msgs, int count)
+{
+    struct i2c_rdwr_ioctl_data data = {.msgs = msgs, .nmsgs = count};
+    int ret;
+    do {
+        ret = ioctl(fd, I2C_RDWR, &data);
+    } while (ret < 0 && errno == EINTR);
+    if (ret == count) {
+        return ESP_OK;
+    }
+    return ret < 0 && errno == ETIMEDOUT ? ESP_ERR_TIMEOUT : ESP_FAIL;
+}
+
+static esp_err_t new_master_bus(const i2c_master_bus_config_t *bus_config,
+                                i2c_master_bus_handle_t *ret_bus_handle,
+                                int cmock_num_calls)
+{
+    if (!ret_bus_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    i2c_master_bus_handle_t bus = calloc(1, sizeof(struct i2c_master_bus_t));
+    if (!bus) {
+        return ESP_ERR_NO_MEM;
+    }
+    bus->fd = open(s_path, O_RDWR | O_CLOEXEC);
+    if (bus->fd < 0) {
+        free(bus);
+        return ESP_ERR_NOT_FOUND;
+    }
+    *ret_bus_handle = bus;
+    return ESP_OK;
+}
+
+static esp_err_t del_master_bus(i2c_master_bus_handle_t bus_handle,
+                                int cmock_num_calls)
+{
+    close(bus_handle->fd);
+    free(bus_handle);
+    return ESP_OK;
+}
+
+static esp_err_t add_device(i2c_master_bus_handle_t bus_handle,
+                            const i2c_device_config_t *dev_config,
+                            i2c_master_dev_handle_t *ret_handle,
+                            int cmock_num_calls)
+{
+    if (!bus_handle || !dev_config || !ret_handle ||
+        dev_config->dev_addr_length != I2C_ADDR_BIT_LEN_7) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    i2c_master_dev_handle_t dev = calloc(1, sizeof(struct i2c_master_dev_t));
+    if (!dev) {
+        return ESP_ERR_NO_MEM;
+    }
+    dev->fd = bus_handle->fd;
+    dev->address = dev_config->device_address;
+    *ret_handle = dev;
+    return ESP_OK;
+}
+
+static esp_err_t rm_device(i2c_master_dev_handle_t handle, int cmock_num_calls)
+{
+    free(handle);
+    return ESP_OK;
+}
+
+static esp_err_t transmit(i2c_master_dev_handle_t i2c_dev,
+                          const uint8_t *write_buffer, size_t write_size,
+                          int xfer_timeout_ms, int cmock_num_calls)
+{
+    struct i2c_msg msg = {
+        .addr = i2c_dev->address,
+        .len = write_size,
+        .buf = (uint8_t *)write_buffer,
+    };
+    return rdwr(i2c_dev->fd, &msg, 1);
+}
+
+static esp_err_t transmit_receive(i2c_master_dev_handle_t i2c_dev,
+                                  const uint8_t *write_buffer,
+                                  size_t write_size, uint8_t *read_buffer,
+                                  size_t read_size, int xfer_timeout_ms,
+                                  int cmock_num_calls)
+{
+    struct i2c_msg msgs[] = {
+        {
+            .addr = i2c_dev->address,
+            .len = write_size,
+            .buf = (uint8_t *)write_buffer,
+        },
+        {
+            .addr = i2c_dev->address,
+            .flags = I2C_M_RD,
+            .len = read_size,
+            .buf = read_buffer,
+        },
+    };
+    return rdwr(i2c_dev->fd, msgs, 2);
+}
+
+static esp_err_t receive(i2c_master_dev_handle_t i2c_dev,
+                         uint8_t *read_buffer, size_t read_size,
+                         int xfer_timeout_ms, int cmock_num_calls)
+{
+    struct i2c_msg msg = {
+        .addr = i2c_dev->address,
+        .flags = I2C_M_RD,
+        .len = read_size,
+        .buf = read_buffer,
+    };
+    return rdwr(i2c_dev->fd, &msg, 1);
+}
+
+/* A one byte read: not every adapter can send an address alone */
+static esp_err_t probe(i2c_master_bus_handle_t bus_handle, uint16_t address,
+                       int xfer_timeout_ms, int cmock_num_calls)
+{
+    uint8_t byte;
+    struct i2c_msg msg = {
+        .addr = address,
+        .flags = I2C_M_RD,
+        .len = 1,
+        .buf = &byte,
+    };
+    return rdwr(bus_handle->fd, &msg, 1) == ESP_OK ? ESP_OK
+                                                   : ESP_ERR_NOT_FOUND;
+}
+
+static int64_t get_time(int cmock_num_calls)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+esp_err_t i2c_dev_attach(const char *path)
+{
+    if (!path || strlen(path) >= sizeof(s_path)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strcpy(s_path, path);
+
+    i2c_new_master_bus_Stub(new_master_bus);
+    i2c_del_master_bus_Stub(del_master_bus);
+    i2c_master_bus_add_device_Stub(add_device);
+    i2c_master_bus_rm_device_Stub(rm_device);
+    i2c_master_transmit_Stub(transmit);
+    i2c_master_transmit_receive_Stub(transmit_receive);
+    i2c_master_receive_Stub(receive);
+    i2c_master_probe_Stub(probe);
+    esp_timer_get_time_Stub(get_time);
+    return ESP_OK;
+}
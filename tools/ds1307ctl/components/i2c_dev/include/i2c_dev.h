@@ -0,0 +1,29 @@
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Route the I2C and esp_timer mocks to a Linux I2C adapter
+ *
+ * Installs CMock stubs for i2c_master.h and esp_timer_get_time, like
+ * ds1307_sim_attach, but the transactions go to the adapter through I2C_RDWR
+ * ioctls: a write, or a write and a read joined by a repeated start, as the
+ * ESP-IDF driver puts them on the wire. esp_timer_get_time reads
+ * CLOCK_MONOTONIC. The adapter is opened by i2c_new_master_bus. It sets the
+ * SCL frequency and the timeout, so scl_speed_hz and xfer_timeout_ms are
+ * ignored. Call after the mocks' Init.
+ *
+ * @param[in] path Adapter device, e.g. "/dev/i2c-1"
+ * @return
+ *      - ESP_OK: Stubs installed
+ *      - ESP_ERR_INVALID_ARG: NULL or overlong path
+ */
+esp_err_t i2c_dev_attach(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,162 @@
+/*
+ * ds1307ctl: the DS1307 driver on a Linux host, over a /dev/i2c-N adapter
+ * or the simulated chip of the host tests.
+ */
+
+#include "Mockesp_timer.h"
+#include "Mocki2c_master.h"
+#include "ds1307_sim.h"
+#include "ds1307ctl.h"
+#include "esp_log.h"
+#include "i2c_dev.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_DEVICE "/dev/i2c-1"
+#define DEFAULT_SPEED_HZ 100000
+#define ARGS_MAX 128
+#define CMDLINE_MAX 4096
+
+typedef struct {
+    const char *device; /*!< NULL for the simulated chip */
+    uint32_t scl_speed_hz;
+    bool multi_master;
+    bool json;
+} options_t;
+
+/* Logs go to stderr, keeping stdout to the results */
+static int log_stderr(const char *format, va_list args)
+{
+    return vfprintf(stderr, format, args);
+}
+
+/* app_main gets no arguments on the linux target; the kernel keeps them */
+static int read_args(char **argv)
+{
+    static char cmdline[CMDLINE_MAX];
+    FILE *f = fopen("/proc/self/cmdline", "rb");
+    if (!f) {
+        return 0;
+    }
+    size_t size = fread(cmdline, 1, sizeof(cmdline) - 1, f);
+    fclose(f);
+    cmdline[size] = '\0';
+    int argc = 0;
+    for (size_t i = 0; i < size && argc < ARGS_MAX;
+         i += strlen(cmdline + i) + 1) {
+        argv[argc++] = cmdline + i;
+    }
+    return argc;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: ds1307ctl [-d DEVICE | --sim] [-s HZ] "
+                    "[--multi-master] [--json] COMMAND [ARG]...\n"
+                    "  -d DEVICE       I2C adapter, default " DEFAULT_DEVICE
+                    "\n"
+                    "  --sim           simulated chip, powered up halted\n"
+                    "  -s HZ           SCL frequency: the adapter's, to time "
+                    "the aligned set,\n"
+                    "                  or the simulated bus's, default 100000\n"
+                    "  --multi-master  RAM generation byte protocol\n"
+                    "  --json          one JSON object per command\n");
+    ds1307ctl_usage(stderr);
+}
+
+/* Options come first; the index of the command, or 0 on a bad option */
+static int parse_options(int argc, char **argv, options_t *options)
+{
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        char *end;
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            options->device = argv[++i];
+        } else if (strcmp(argv[i], "--sim") == 0) {
+            options->device = NULL;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            options->scl_speed_hz = strtoul(argv[++i], &end, 0);
+            if (*end != '\0' || options->scl_speed_hz == 0) {
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--multi-master") == 0) {
+            options->multi_master = true;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            options->json = true;
+        } else {
+            return 0;
+        }
+    }
+    return i < argc ? i : 0;
+}
+
+static int run(int argc, char **argv)
+{
+    options_t options = {
+        .device = DEFAULT_DEVICE,
+        .scl_speed_hz = DEFAULT_SPEED_HZ,
+    };
+    int command = parse_options(argc, argv, &options);
+    if (!command) {
+        usage();
+        return DS1307CTL_EXIT_USAGE;
+    }
+
+    Mocki2c_master_Init();
+    Mockesp_timer_Init();
+    esp_err_t ret = ESP_OK;
+    if (options.device) {
+        ret = i2c_dev_attach(options.device);
+    } else {
+        ds1307_sim_attach();
+        ds1307_sim_set_bus_speed(options.scl_speed_hz);
+    }
+    const i2c_master_bus_config_t bus_config = {
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .i2c_port = -1,
+    };
+    const ds1307_config_t config = {
+        .ds1307_device.device_address = DS1307_ADDRESS,
+        .ds1307_device.scl_speed_hz = options.scl_speed_hz,
+        .multi_master = options.multi_master,
+    };
+    i2c_master_bus_handle_t bus_handle = NULL;
+    ds1307_handle_t ds1307_handle = NULL;
+    if (ret == ESP_OK) {
+        ret = i2c_new_master_bus(&bus_config, &bus_handle);
+    }
+    if (ret == ESP_OK) {
+        ret = ds1307_init(bus_handle, &config, &ds1307_handle);
+    }
+    int status;
+    if (ret == ESP_OK) {
+        status = ds1307ctl_run(ds1307_handle, options.json, argc - command,
+                               argv + command, stdout);
+    } else if (options.json) {
+        printf("{\"error\": \"%s\"}\n", esp_err_to_name(ret));
+        status = DS1307CTL_EXIT_ERROR;
+    } else {
+        printf("error: %s: %s\n",
+               options.device ? options.device : "simulated chip",
+               esp_err_to_name(ret));
+        status = DS1307CTL_EXIT_ERROR;
+    }
+    if (ds1307_handle) {
+        ds1307_deinit(ds1307_handle);
+    }
+    if (bus_handle) {
+        i2c_del_master_bus(bus_handle);
+    }
+    return status;
+}
+
+void app_main(void)
+{
+    static char *argv[ARGS_MAX];
+    esp_log_set_vprintf(log_stderr);
+    int status = run(read_args(argv), argv);
+    fflush(stdout);
+    exit(status);
+}